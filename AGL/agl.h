@@ -2,6 +2,19 @@
 #define AGL_H
 
 #include "util.h"
+#include "program.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "transform.h"
+#include "bounds.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "pick_buffer.h"
+#include "registry.h"
+#include "ring_buffer.h"
+#include "slot_map.h"
+#include "spatial_grid.h"
+#include "triangle_tree.h"
 #include "scene.h"
 #include "entity.h"
 #include "shapes.h"
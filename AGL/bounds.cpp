@@ -0,0 +1,101 @@
+#include "bounds.h"
+#include<algorithm>
+#include<cmath>
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+#include<xmmintrin.h>
+#endif
+
+namespace agl {
+void BoundingSpheres::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    r.clear();
+}
+void BoundingSpheres::push(const glm::vec3 &center, float radius)
+{
+    x.push_back(center.x);
+    y.push_back(center.y);
+    z.push_back(center.z);
+    r.push_back(radius);
+}
+float transformSphere(const glm::vec3 &center, float radius, const glm::mat4 &M, glm::vec3 &worldCenter)
+{
+    worldCenter = glm::vec3(M * glm::vec4(center, 1));
+    float scale2 = std::max(std::max(glm::dot(glm::vec3(M[0]), glm::vec3(M[0])),
+                                     glm::dot(glm::vec3(M[1]), glm::vec3(M[1]))),
+                            glm::dot(glm::vec3(M[2]), glm::vec3(M[2])));
+    return radius * std::sqrt(scale2);
+}
+
+Frustum::Frustum(const glm::mat4 &VP)
+{
+    glm::vec4 rows[4];
+    for(int i=0; i<4; ++i)
+        rows[i] = glm::vec4(VP[0][i], VP[1][i], VP[2][i], VP[3][i]);
+    for(int i=0; i<3; ++i)
+    {
+        planes[2*i] = rows[3] + rows[i];
+        planes[2*i + 1] = rows[3] - rows[i];
+    }
+    for(glm::vec4 &p: planes)
+        p /= glm::length(glm::vec3(p));  // so that the distances compare to the radii
+}
+bool Frustum::intersects(const glm::vec3 &center, float radius) const
+{
+    for(const glm::vec4 &p: planes)
+        if(glm::dot(glm::vec3(p), center) + p.w < -radius)
+            return false;
+    return true;
+}
+bool Frustum::intersects(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+    for(const glm::vec4 &p: planes)
+    {
+        glm::vec3 corner(p.x < 0 ? boxMin.x : boxMax.x, p.y < 0 ? boxMin.y : boxMax.y,
+                         p.z < 0 ? boxMin.z : boxMax.z);  // the corner furthest along the normal
+        if(glm::dot(glm::vec3(p), corner) + p.w < 0)
+            return false;
+    }
+    return true;
+}
+size_t Frustum::cull(const BoundingSpheres &spheres, uint8_t *visible) const
+{
+    size_t i = 0, n = spheres.size(), count = 0;
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+    __m128 px[6], py[6], pz[6], pw[6];
+    for(int k=0; k<6; ++k)
+    {
+        px[k] = _mm_set1_ps(planes[k].x);
+        py[k] = _mm_set1_ps(planes[k].y);
+        pz[k] = _mm_set1_ps(planes[k].z);
+        pw[k] = _mm_set1_ps(planes[k].w);
+    }
+    for(; i+4<=n; i+=4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]), y = _mm_loadu_ps(&spheres.y[i]), z = _mm_loadu_ps(&spheres.z[i]),
+               r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.r[i]));
+        __m128 in = _mm_cmpeq_ps(r, r);  // all set
+        for(int k=0; k<6; ++k)
+        {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[k], x), _mm_mul_ps(py[k], y)),
+                                  _mm_add_ps(_mm_mul_ps(pz[k], z), pw[k]));
+            in = _mm_and_ps(in, _mm_cmpge_ps(d, r));
+        }
+        int mask = _mm_movemask_ps(in);
+        for(int k=0; k<4; ++k)
+        {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+#endif
+    for(; i<n; ++i)
+    {
+        visible[i] = intersects(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.r[i]);
+        count += visible[i];
+    }
+    return count;
+}
+}
@@ -0,0 +1,81 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include<vector>
+#include<cstddef>
+#include<cstdint>
+#include "glm/glm.hpp"
+
+namespace agl {
+/*!
+ * \brief Bounding spheres packed as a structure of arrays, so that #Frustum::cull can test four at once.
+ */
+struct BoundingSpheres
+{
+    std::vector<float> x,  //!< X of the centers.
+                       y,  //!< Y of the centers.
+                       z,  //!< Z of the centers.
+                       r;  //!< Radii.
+
+    /*!
+     * \brief Remove all the spheres, keeping the memory.
+     */
+    void clear();
+    /*!
+     * \brief Add a sphere.
+     */
+    void push(const glm::vec3 &center, float radius);
+    /*!
+     * \brief Number of spheres.
+     */
+    inline size_t size() const
+    {
+        return r.size();
+    }
+};
+
+/*!
+ * \brief Transform a bounding sphere to world space.
+ * \param center Center in model space.
+ * \param radius Radius in model space.
+ * \param M Model matrix.
+ * \param worldCenter Gets the center in world space.
+ * \return Radius in world space, scaled by the largest scale of \a M so the sphere still encloses the mesh.
+ */
+float transformSphere(const glm::vec3 &center, float radius, const glm::mat4 &M, glm::vec3 &worldCenter);
+
+/*!
+ * \brief The six planes of a view frustum, pointing inwards.
+ */
+struct Frustum
+{
+    glm::vec4 planes[6];  //!< Left, right, bottom, top, near and far; \c xyz is the unit normal, \c w the distance.
+
+    /*!
+     * \brief Extract the planes from a view-projection matrix, eg. Scene#getMatVP.
+     *
+     * See Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix".
+     * The planes are in the space the matrix transforms from, so the world space for the VP matrix.
+     */
+    explicit Frustum(const glm::mat4 &VP);
+    /*!
+     * \brief Test whether a sphere may be visible, ie. is not completely outside one of the planes.
+     */
+    bool intersects(const glm::vec3 &center, float radius) const;
+    /*!
+     * \brief Test whether an axis aligned box may be visible, ie. is not completely outside one of the planes.
+     */
+    bool intersects(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+    /*!
+     * \brief Test many spheres against the frustum.
+     * \param spheres The spheres.
+     * \param visible Gets 1 for each sphere that may be visible, 0 for the others; room for \a spheres.size().
+     * \return Number of spheres that may be visible.
+     *
+     * With SSE four spheres are tested against a plane with a single multiply-add chain and a compare.
+     */
+    size_t cull(const BoundingSpheres &spheres, uint8_t *visible) const;
+};
+}
+
+#endif // BOUNDS_H
@@ -0,0 +1,336 @@
+#include "bvh.h"
+#include "util.h"
+#include<algorithm>
+#include<cmath>
+
+namespace agl {
+namespace {
+float area(const glm::vec3 &mn, const glm::vec3 &mx)
+{
+    glm::vec3 d = glm::max(mx - mn, glm::vec3(0));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+/*
+ * Bitmask of the planes a box is not completely inside of, among those in mask; -1 if it is outside one of them.
+ */
+int classify(const Frustum &f, const glm::vec3 &mn, const glm::vec3 &mx, int mask)
+{
+    for(int i=0; i<6; ++i)
+    {
+        if(!(mask & (1 << i)))
+            continue;
+        const glm::vec4 &p = f.planes[i];
+        glm::vec3 far(p.x < 0 ? mn.x : mx.x, p.y < 0 ? mn.y : mx.y, p.z < 0 ? mn.z : mx.z),
+                  near(p.x < 0 ? mx.x : mn.x, p.y < 0 ? mx.y : mn.y, p.z < 0 ? mx.z : mn.z);
+        if(glm::dot(glm::vec3(p), far) + p.w < 0)
+            return -1;
+        if(glm::dot(glm::vec3(p), near) + p.w >= 0)
+            mask &= ~(1 << i);  // the children are inside this plane as well
+    }
+    return mask;
+}
+/*
+ * Distance along the ray to the box, or INFINITY if it misses it before tmax. invDir is 1 / the direction.
+ */
+float rayBox(const glm::vec3 &origin, const glm::vec3 &invDir, const glm::vec3 &mn, const glm::vec3 &mx, float tmax)
+{
+    glm::vec3 t0 = (mn - origin) * invDir, t1 = (mx - origin) * invDir;
+    glm::vec3 tn = glm::min(t0, t1), tf = glm::max(t0, t1);
+    float enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, 0.f)),
+          exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, tmax));
+    return enter <= exit ? enter : INFINITY;  // NaNs of an origin on a slab fail the compare, ie. miss
+}
+bool overlaps(const glm::vec3 &mn0, const glm::vec3 &mx0, const glm::vec3 &mn1, const glm::vec3 &mx1)
+{
+    return mn0.x <= mx1.x && mn1.x <= mx0.x && mn0.y <= mx1.y && mn1.y <= mx0.y && mn0.z <= mx1.z && mn1.z <= mx0.z;
+}
+bool overlapsSphere(const glm::vec3 &mn, const glm::vec3 &mx, const glm::vec3 &center, float radius)
+{
+    glm::vec3 d = center - glm::clamp(center, mn, mx);
+    return glm::dot(d, d) <= radius * radius;
+}
+}
+
+void BVH::build(const std::vector<glm::vec3> &mins, const std::vector<glm::vec3> &maxs)
+{
+    itemMin = mins;
+    itemMax = maxs;
+    size_t n = mins.size();
+    order.resize(n);
+    for(size_t i=0; i<n; ++i)
+        order[i] = i;
+    std::vector<glm::vec3> centroids(n);
+    for(size_t i=0; i<n; ++i)
+        centroids[i] = mins[i] + maxs[i];  // twice the center, the factor doesn't matter
+    nodes.clear();
+    builtArea = 0;
+    if(n == 0)  // a root without items would be an inner node
+        return;
+    nodes.reserve(2 * n);
+    Node root;
+    root.first = 0;
+    root.count = n;
+    nodes.push_back(root);
+    std::vector<uint32_t> stack(1, 0);
+    while(!stack.empty())
+    {
+        uint32_t ni = stack.back();
+        stack.pop_back();
+        uint32_t first = nodes[ni].first, count = nodes[ni].count;
+        glm::vec3 mn(INFINITY), mx(-INFINITY), cmn(INFINITY), cmx(-INFINITY);
+        for(uint32_t i=first; i<first+count; ++i)
+        {
+            mn = glm::min(mn, mins[order[i]]);
+            mx = glm::max(mx, maxs[order[i]]);
+            cmn = glm::min(cmn, centroids[order[i]]);
+            cmx = glm::max(cmx, centroids[order[i]]);
+        }
+        nodes[ni].min = mn;
+        nodes[ni].max = mx;
+        if(count <= AGL_BVH_LEAF_SIZE)
+            continue;
+
+        glm::vec3 extent = cmx - cmn;
+        int axis = extent.x > extent.y ? extent.x > extent.z ? 0 : 2 : extent.y > extent.z ? 1 : 2;
+        uint32_t mid = first + count / 2;
+        if(extent[axis] > 0)  // SAH over the bins of the centroids
+        {
+            struct Bin
+            {
+                glm::vec3 mn = glm::vec3(INFINITY), mx = glm::vec3(-INFINITY);
+                uint32_t count = 0;
+            } bins[AGL_BVH_BINS];
+            float scale = AGL_BVH_BINS / extent[axis];
+            auto binOf = [&](uint32_t item) {
+                return std::min(int((centroids[item][axis] - cmn[axis]) * scale), AGL_BVH_BINS - 1);
+            };
+            for(uint32_t i=first; i<first+count; ++i)
+            {
+                Bin &b = bins[binOf(order[i])];
+                b.mn = glm::min(b.mn, mins[order[i]]);
+                b.mx = glm::max(b.mx, maxs[order[i]]);
+                ++b.count;
+            }
+            float rightArea[AGL_BVH_BINS];  // area of the bins from i to the last, times their count
+            glm::vec3 rmn(INFINITY), rmx(-INFINITY);
+            uint32_t rcount = 0;
+            for(int i=AGL_BVH_BINS-1; i>0; --i)
+            {
+                rmn = glm::min(rmn, bins[i].mn);
+                rmx = glm::max(rmx, bins[i].mx);
+                rcount += bins[i].count;
+                rightArea[i] = rcount == 0 ? 0 : area(rmn, rmx) * rcount;
+            }
+            glm::vec3 lmn(INFINITY), lmx(-INFINITY);
+            uint32_t lcount = 0;
+            float bestCost = INFINITY;
+            int best = 0;
+            for(int i=1; i<AGL_BVH_BINS; ++i)  // split before bin i
+            {
+                lmn = glm::min(lmn, bins[i-1].mn);
+                lmx = glm::max(lmx, bins[i-1].mx);
+                lcount += bins[i-1].count;
+                float cost = (lcount == 0 ? 0 : area(lmn, lmx) * lcount) + rightArea[i];
+                if(lcount > 0 && lcount < count && cost < bestCost)
+                {
+                    bestCost = cost;
+                    best = i;
+                }
+            }
+            if(best > 0)
+                mid = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t item) {
+                    return binOf(item) < best;
+                }) - order.begin();
+        }
+        else  // all the centroids coincide, split in the middle to keep the depth logarithmic
+            std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count);
+
+        Node left, right;
+        left.first = first;
+        left.count = mid - first;
+        right.first = mid;
+        right.count = first + count - mid;
+        nodes[ni].first = nodes.size();
+        nodes[ni].count = 0;
+        stack.push_back(nodes.size());
+        stack.push_back(nodes.size() + 1);
+        nodes.push_back(left);
+        nodes.push_back(right);
+    }
+    builtArea = totalArea();
+}
+bool BVH::refit(const std::vector<glm::vec3> &mins, const std::vector<glm::vec3> &maxs)
+{
+    if(mins.size() != itemMin.size() || nodes.empty())
+        return false;
+    itemMin = mins;
+    itemMax = maxs;
+    for(size_t ni=nodes.size(); ni-->0;)  // the children first
+    {
+        Node &node = nodes[ni];
+        if(node.count == 0)
+        {
+            node.min = glm::min(nodes[node.first].min, nodes[node.first + 1].min);
+            node.max = glm::max(nodes[node.first].max, nodes[node.first + 1].max);
+            continue;
+        }
+        node.min = glm::vec3(INFINITY);
+        node.max = glm::vec3(-INFINITY);
+        for(uint32_t i=node.first; i<node.first+node.count; ++i)
+        {
+            node.min = glm::min(node.min, mins[order[i]]);
+            node.max = glm::max(node.max, maxs[order[i]]);
+        }
+    }
+    return totalArea() <= AGL_BVH_REFIT_LIMIT * builtArea;
+}
+float BVH::totalArea() const
+{
+    float res = 0;
+    for(const Node &node: nodes)
+        res += area(node.min, node.max);
+    return res;
+}
+void BVH::query(const Frustum &f, std::vector<uint32_t> &items, std::vector<uint32_t> *partial) const
+{
+    if(nodes.empty())
+        return;
+    std::vector<std::pair<uint32_t, int>> stack(1, std::make_pair(0u, 0x3F));  // node and the planes left to test
+    while(!stack.empty())
+    {
+        uint32_t ni = stack.back().first;
+        int mask = stack.back().second;
+        stack.pop_back();
+        const Node &node = nodes[ni];
+        if(mask != 0)
+            mask = classify(f, node.min, node.max, mask);
+        if(mask < 0)
+            continue;
+        if(node.count == 0)
+        {
+            stack.push_back(std::make_pair(node.first, mask));
+            stack.push_back(std::make_pair(node.first + 1, mask));
+            continue;
+        }
+        for(uint32_t i=node.first; i<node.first+node.count; ++i)
+        {
+            uint32_t item = order[i];
+            if(mask == 0)  // inside the frustum
+                items.push_back(item);
+            else if(partial != nullptr)
+                partial->push_back(item);
+            else if(classify(f, itemMin[item], itemMax[item], mask) >= 0)
+                items.push_back(item);
+        }
+    }
+}
+void BVH::query(const glm::vec3 &boxMin, const glm::vec3 &boxMax, std::vector<uint32_t> &items) const
+{
+    if(nodes.empty())
+        return;
+    std::vector<uint32_t> stack(1, 0);
+    while(!stack.empty())
+    {
+        const Node &node = nodes[stack.back()];
+        stack.pop_back();
+        if(!overlaps(node.min, node.max, boxMin, boxMax))
+            continue;
+        if(node.count == 0)
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+            continue;
+        }
+        for(uint32_t i=node.first; i<node.first+node.count; ++i)
+            if(overlaps(itemMin[order[i]], itemMax[order[i]], boxMin, boxMax))
+                items.push_back(order[i]);
+    }
+}
+void BVH::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &items) const
+{
+    if(nodes.empty())
+        return;
+    std::vector<uint32_t> stack(1, 0);
+    while(!stack.empty())
+    {
+        const Node &node = nodes[stack.back()];
+        stack.pop_back();
+        if(!overlapsSphere(node.min, node.max, center, radius))
+            continue;
+        if(node.count == 0)
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+            continue;
+        }
+        for(uint32_t i=node.first; i<node.first+node.count; ++i)
+            if(overlapsSphere(itemMin[order[i]], itemMax[order[i]], center, radius))
+                items.push_back(order[i]);
+    }
+}
+uint32_t BVH::raycast(const glm::vec3 &origin, const glm::vec3 &dir, float &t,
+                      const std::function<bool(uint32_t, float&)> &hit) const
+{
+    uint32_t res = NONE;
+    glm::vec3 invDir = 1.f / dir;
+    raycastLeaves(origin, dir, t, [&](uint32_t first, uint32_t count, float &best) {
+        bool found = false;
+        for(uint32_t i=first; i<first+count; ++i)
+        {
+            uint32_t item = order[i];
+            float d = rayBox(origin, invDir, itemMin[item], itemMax[item], best);
+            if(d == INFINITY)
+                continue;
+            if(hit ? hit(item, best) : d < best)
+            {
+                if(!hit)
+                    best = d;
+                res = item;
+                found = true;
+            }
+        }
+        return found;
+    });
+    return res;
+}
+bool BVH::raycastLeaves(const glm::vec3 &origin, const glm::vec3 &dir, float &t,
+                        const std::function<bool(uint32_t, uint32_t, float&)> &hit) const
+{
+    if(nodes.empty())
+        return false;
+    bool res = false;
+    glm::vec3 invDir = 1.f / dir;
+    std::vector<std::pair<uint32_t, float>> stack;  // node and the distance to its box
+    stack.reserve(64);
+    float d = rayBox(origin, invDir, nodes[0].min, nodes[0].max, t);
+    if(d != INFINITY)
+        stack.push_back(std::make_pair(0u, d));
+    while(!stack.empty())
+    {
+        uint32_t ni = stack.back().first;
+        float dist = stack.back().second;
+        stack.pop_back();
+        if(dist > t)  // something nearer was hit meanwhile
+            continue;
+        const Node &node = nodes[ni];
+        if(node.count > 0)
+        {
+            res |= hit(node.first, node.count, t);
+            continue;
+        }
+        float d0 = rayBox(origin, invDir, nodes[node.first].min, nodes[node.first].max, t),
+              d1 = rayBox(origin, invDir, nodes[node.first + 1].min, nodes[node.first + 1].max, t);
+        uint32_t near = node.first, far = node.first + 1;
+        if(d1 < d0)
+        {
+            std::swap(d0, d1);
+            std::swap(near, far);
+        }
+        if(d1 != INFINITY)
+            stack.push_back(std::make_pair(far, d1));
+        if(d0 != INFINITY)
+            stack.push_back(std::make_pair(near, d0));  // popped first
+    }
+    return res;
+}
+}
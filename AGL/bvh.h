@@ -0,0 +1,127 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include<vector>
+#include<functional>
+#include<cstdint>
+#include "bounds.h"
+#include "glm/glm.hpp"
+
+namespace agl {
+/*!
+ * \brief [Bounding volume hierarchy](https://en.wikipedia.org/wiki/Bounding_volume_hierarchy) over axis aligned boxes.
+ *
+ * The items are numbered 0 to #size - 1 by the order of the boxes given to #build, and the queries return these
+ * numbers. The tree is a binary tree of boxes stored in #nodes, built top-down with the surface area heuristic (SAH):
+ * each node is split where the sum of the areas of the children weighted by their number of items is smallest,
+ * evaluated over #AGL_BVH_BINS bins of the centroids.
+ *
+ * When the items move, #refit updates the boxes bottom-up in a single linear pass, keeping the topology. The tree
+ * degrades as the items drift apart, so #refit reports when the total area of the nodes grew by more than
+ * #AGL_BVH_REFIT_LIMIT times since the build, and the owner builds it again. Scene does this every frame, unless
+ * Scene#useGrid.
+ */
+class BVH
+{
+public:
+    /*!
+     * \brief A node of the tree.
+     */
+    struct Node
+    {
+        glm::vec3 min;  //!< Minimum of the box around the items of the node.
+        uint32_t first;  //!< First child, the second follows it; for a leaf, the first item in BVH#order.
+        glm::vec3 max;  //!< Maximum of the box around the items of the node.
+        uint32_t count;  //!< Number of items of a leaf, 0 for an inner node.
+    };
+
+    static constexpr uint32_t NONE = 0xFFFFFFFF;  //!< No item, see #raycast.
+
+    std::vector<Node> nodes;  //!< The nodes, the root first; the children always come after their parent.
+    std::vector<uint32_t> order;  //!< The items, in the order of the leaves.
+    std::vector<glm::vec3> itemMin,  //!< Minimum of the box of each item.
+                           itemMax;  //!< Maximum of the box of each item.
+
+    /*!
+     * \brief Build the tree.
+     * \param mins Minimum of the box of each item.
+     * \param maxs Maximum of the box of each item.
+     */
+    void build(const std::vector<glm::vec3> &mins, const std::vector<glm::vec3> &maxs);
+    /*!
+     * \brief Move the items and update the boxes of the nodes, keeping the topology.
+     * \param mins New minimum of the box of each item.
+     * \param maxs New maximum of the box of each item.
+     * \return \c false if the tree should be built again instead: the number of items changed, or the tree degraded.
+     */
+    bool refit(const std::vector<glm::vec3> &mins, const std::vector<glm::vec3> &maxs);
+    /*!
+     * \brief Number of items.
+     */
+    inline size_t size() const
+    {
+        return itemMin.size();
+    }
+    /*!
+     * \brief Find the items whose box may be visible in a frustum.
+     * \param f The frustum.
+     * \param items Gets the items; it is not cleared.
+     * \param partial If not \c nullptr, gets the items of the leaves crossing a plane of the frustum without testing
+     * them, so that the caller can test them more precisely; otherwise their boxes are tested.
+     *
+     * A node completely inside a plane does not test it again below, and a node completely inside the frustum takes
+     * all its items without any test.
+     */
+    void query(const Frustum &f, std::vector<uint32_t> &items, std::vector<uint32_t> *partial=nullptr) const;
+    /*!
+     * \brief Find the items whose box overlaps a box.
+     * \param boxMin Minimum of the box.
+     * \param boxMax Maximum of the box.
+     * \param items Gets the items; it is not cleared.
+     */
+    void query(const glm::vec3 &boxMin, const glm::vec3 &boxMax, std::vector<uint32_t> &items) const;
+    /*!
+     * \brief Find the items whose box overlaps a sphere.
+     * \param center Center of the sphere.
+     * \param radius Radius of the sphere.
+     * \param items Gets the items; it is not cleared.
+     */
+    void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &items) const;
+    /*!
+     * \brief Find the nearest item hit by a ray.
+     * \param origin Origin of the ray.
+     * \param dir Direction of the ray; need not be normalized, the distances are in its lengths.
+     * \param t Maximum distance along the ray; gets the distance of the hit.
+     * \param hit Optional exact test of an item whose box the ray hits. It gets the item and the distance of the
+     * nearest hit so far, and returns \c true and updates the distance if it hits the item closer. Without it, the
+     * boxes are the hits.
+     * \return The item hit, or #NONE.
+     *
+     * The nearer child is visited first and the nodes beyond the nearest hit are skipped.
+     */
+    uint32_t raycast(const glm::vec3 &origin, const glm::vec3 &dir, float &t,
+                     const std::function<bool(uint32_t, float&)> &hit=nullptr) const;
+    /*!
+     * \brief Find the nearest leaf hit by a ray, testing the items of each leaf together, eg. with SIMD.
+     * \param origin Origin of the ray.
+     * \param dir Direction of the ray.
+     * \param t Maximum distance along the ray; gets the distance of the hit.
+     * \param hit Test of a leaf whose box the ray hits. It gets the position of the first item of the leaf in #order,
+     * the number of items and the distance of the nearest hit so far, and returns \c true and updates the distance if
+     * it hits an item closer.
+     * \return Was anything hit?
+     */
+    bool raycastLeaves(const glm::vec3 &origin, const glm::vec3 &dir, float &t,
+                       const std::function<bool(uint32_t, uint32_t, float&)> &hit) const;
+
+private:
+    float builtArea = 0;  //!< Total area of the nodes after #build.
+
+    /*!
+     * \brief Total surface area of the nodes, ie. the SAH cost of the tree up to constant factors.
+     */
+    float totalArea() const;
+};
+}
+
+#endif // BVH_H
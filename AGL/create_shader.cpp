@@ -1,9 +1,19 @@
 #include "entity.h"
 #include<sstream>
+#include<algorithm>
 
 namespace agl {
 namespace {
-std::pair<GLfloat, GLfloat> getMinMax(std::vector<GLfloat> &vertices, int length, int stride, int offset)
+// Per-frame constants, filled once per frame by Scene; must match FrameBlock.
+const char *FRAME_BLOCK = "layout(std140) uniform Frame {\n"
+                          "    mat4 VP, V, P;\n"
+                          "    vec3 vpos;\n"
+                          "    float time;\n"
+                          "    vec2 resolution;\n"
+                          "    float deltaTime;\n"
+                          "};\n";
+
+std::pair<GLfloat, GLfloat> getMinMax(const std::vector<GLfloat> &vertices, int length, int stride, int offset)
 {
     float mn = vertices[offset], mx = vertices[offset];
     for(int i=1; i<length; ++i)
@@ -16,7 +26,8 @@ std::pair<GLfloat, GLfloat> getMinMax(std::vector<GLfloat> &vertices, int length
 
 void setColorComp(const char *comp, glm::vec4 color, Entity *e, std::stringstream &fs)
 {
-    int l = e->vertices.size() / 3;
+    const Mesh &m = e->getMesh();
+    int l = m.vertices.size() / 3;
     std::pair<GLfloat, GLfloat> mnmx;
     switch(int(color.w))
     {
@@ -25,7 +36,8 @@ void setColorComp(const char *comp, glm::vec4 color, Entity *e, std::stringstrea
         for(int i=0; i<3; ++i)
             if(color[i] == -1)
             {
-                mnmx = getMinMax(e->vertices, l, 3, i);
+                mnmx = m.mergedStale ? getMinMax(m.vertices, l, 3, i) :  // the bounds survive Mesh::release
+                       std::make_pair(m.boundsMin[i], m.boundsMax[i]);
                 fs << "(pos[" << i << "] - " << mnmx.first << ") * " << 1 / (mnmx.second - mnmx.first) << ", ";
             }
             else
@@ -73,12 +85,13 @@ void setupColors(Material *m, Entity *e, std::stringstream &fs, bool lightsEnabl
 }
 }
 
-std::pair<std::string, std::string> Material::createShader(Entity *e, std::vector<Light*> lights)
+std::pair<std::string, std::string> Material::createShader(Entity *e, std::vector<Light*> lights, bool instanced)
 {
     std::stringstream vs, fs;
-    bool norm = !e->normals.empty(),
-         tex = !e->uvs.empty() && tex_width>0 && tex_height>0 && tex_channel>0 && texture!=nullptr,
-         norm2col = (ambient.w==AGL_COLOR_NORM2RGB || diffuse.w==AGL_COLOR_NORM2RGB || specular.w==AGL_COLOR_NORM2RGB || emission.w==AGL_COLOR_NORM2RGB) && norm;
+    bool norm = e->getMesh().hasNormals(),
+         tex = e->getMesh().hasUVs() && tex_width>0 && tex_height>0 && tex_channel>0 && texture!=nullptr,
+         norm2col = (ambient.w==AGL_COLOR_NORM2RGB || diffuse.w==AGL_COLOR_NORM2RGB || specular.w==AGL_COLOR_NORM2RGB || emission.w==AGL_COLOR_NORM2RGB) && norm,
+         instEmission = instanced && (lightsEnabled || emission.w >= 0);  // emission comes from the instance data
 // ----------vertex shader----------
     vs << "#version " << AGL_GLVERSION_MAJOR << AGL_GLVERSION_MINOR << "0 core\n"
           "layout(location = 0) in vec3 vertexPos;\n";
@@ -86,33 +99,47 @@ std::pair<std::string, std::string> Material::createShader(Entity *e, std::vecto
         vs << "layout(location = 1) in vec3 normal;\n";
     if(tex)
         vs << "layout(location = " << (norm ? 2 : 1) << ") in vec2 texCoord;\n";
-    vs << "uniform mat4 MVP;\n"
-          "out vec3 pos;\n";
+    vs << FRAME_BLOCK;
+    if(instanced)  // per-instance matrices replace the uniforms, see InstanceData
+        vs << "layout(location = " << AGL_INSTANCE_ATTRIB << ") in mat4 M;\n";
+    else
+        vs << "uniform mat4 M;\n";
+    vs << "out vec3 pos;\n";
     if(norm2col)
         vs << "out vec3 nrm;\n";
     if(lightsEnabled)
     {
-        vs << "uniform mat4 M;\n"
-              "out vec3 fpos;\n";
+        vs << "out vec3 fpos;\n";
         if(norm)
-            vs << "uniform mat3 N;\n"
-                  "out vec3 norm;\n";
+        {
+            if(instanced)
+                vs << "layout(location = " << AGL_INSTANCE_ATTRIB+4 << ") in mat3 N;\n";
+            else
+                vs << "uniform mat3 N;\n";
+            vs << "out vec3 norm;\n";
+        }
     }
+    if(instEmission)
+        vs << "layout(location = " << AGL_INSTANCE_ATTRIB+7 << ") in vec4 instanceEmission;\n"
+              "flat out vec4 emission;\n";
     if(tex)
         vs << "out vec2 uv;\n";
     vs << "void main() {\n"
           "    pos = vertexPos;\n"
-          "    gl_Position = MVP * vec4(vertexPos, 1);\n";
+          "    vec4 world = M * vec4(vertexPos, 1);\n"
+          "    gl_Position = VP * world;\n";
     if(norm2col)
         vs << "    nrm = normal;\n";
     if(lightsEnabled)
     {
-        vs << "    fpos = vec3(M * vec4(vertexPos,1));\n";
+        vs << "    fpos = vec3(world);\n";
         if(norm)
             vs << "    norm = N * normal;\n";
     }
     if(tex)
         vs << "    uv = texCoord;\n";
+    if(instEmission)
+        vs << "    emission = instanceEmission;\n";
     vs << "}";
 // ----------fragement shader----------
     fs << "#version " << AGL_GLVERSION_MAJOR << AGL_GLVERSION_MINOR << "0 core\n"
@@ -125,15 +152,18 @@ std::pair<std::string, std::string> Material::createShader(Entity *e, std::vecto
     if(lightsEnabled)
     {
        fs << (norm ? "in vec3 fpos, norm;\n" :  "in vec3 fpos;\n") <<
-       "uniform vec4 emission, ambient, diffuse, specular;\n"
-       "uniform float shininess;\n"
-       "uniform vec3 vpos;\n\n"
+       (instEmission ? "flat in vec4 emission;\n" : "uniform vec4 emission;\n") <<
+       "uniform vec4 ambient, diffuse, specular;\n"
+       "uniform float shininess;\n" << FRAME_BLOCK << "\n"
        "#define NUM_LIGHTS " << lights.size() << "\n"
-       "uniform struct Light {\n"
+       "struct Light {\n"
        "    vec4 ambient, diffuse, specular, position;\n"
-       "    vec3 halfVector, spotDirection;\n"
-       "    float spotExponent, spotCutoff, spotCosCutoff, constantAttenuation, linearAttenuation, quadraticAttenuation;\n"
-       "} lights[NUM_LIGHTS];\n\n";
+       "    vec3 spotDirection;\n"
+       "    float spotExponent, spotCosCutoff, constantAttenuation, linearAttenuation, quadraticAttenuation;\n"
+       "};\n"
+       "layout(std140) uniform Lights {\n"
+       "    Light lights[" << std::max<size_t>(lights.size(), 1) << "];\n"  // no empty arrays, the loops skip it
+       "};\n\n";
        if(lightingModel == AGL_LIGHTING_PBR)
        {
     fs << "float DGGX(vec3 N, vec3 H, float roughness)\n{\n"
@@ -166,7 +196,7 @@ std::pair<std::string, std::string> Material::createShader(Entity *e, std::vecto
        }
     }
     else if(emission.w >= 0)
-        fs << "uniform vec4 emission;\n";
+        fs << (instEmission ? "flat in vec4 emission;\n" : "uniform vec4 emission;\n");
     fs << "out vec4 color;\n"
           "void main() {\n";
     if(lightsEnabled && lightingModel==AGL_LIGHTING_PBR)
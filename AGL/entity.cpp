@@ -1,21 +1,89 @@
 #include "entity.h"
 #include "scene.h"
 #include "util.h"
+#include "gl_state.h"
+#include "registry.h"
 #include "glm/gtc/matrix_transform.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "../AGL/stb_image.h"
 
 namespace agl {
-BaseEntity::~BaseEntity() = default;
+BaseEntity::BaseEntity(Type type): type(type) {}
+BaseEntity::BaseEntity(const BaseEntity &other): type(other.type), parent(other.parent) {}
+BaseEntity &BaseEntity::operator=(const BaseEntity &other)
+{
+    parent = other.parent;
+    return *this;
+}
+BaseEntity::~BaseEntity()
+{
+    if(registry != nullptr)
+        registry->erase(*this);
+}
 
-Entity::Entity(const glm::vec3 &pos): position(pos){}
-Entity::Entity(const Entity &other): vertices(other.vertices), normals(other.normals), uvs(other.uvs),
-    indices(other.indices), position(other.position), model(other.model), material(other.material) {}
+Entity::Entity(const glm::vec3 &pos): BaseEntity(ENTITY), transformID(getTransforms().create())
+{
+    setPosition(pos);
+}
+Entity::Entity(const Entity &other): BaseEntity(ENTITY), dynamic(other.dynamic), mesh(other.mesh),
+    retention(other.retention), transformID(getTransforms().create()), material(other.material)
+{
+    setPosition(other.getPosition());
+    setModel(other.getModel());
+}
+Entity::Entity(Entity &&other): BaseEntity(ENTITY), dynamic(other.dynamic), mesh(std::move(other.mesh)),
+    retention(other.retention), transformID(getTransforms().create()), material(std::move(other.material))
+{
+    setPosition(other.getPosition());
+    setModel(other.getModel());
+}
+Entity &Entity::operator=(const Entity &other)
+{
+    dynamic = other.dynamic;
+    mesh = other.mesh;
+    retention = other.retention;
+    material = other.material;
+    setPosition(other.getPosition());
+    setModel(other.getModel());
+    return *this;
+}
+Entity &Entity::operator=(Entity &&other)
+{
+    dynamic = other.dynamic;
+    mesh = std::move(other.mesh);
+    retention = other.retention;
+    material = std::move(other.material);
+    setPosition(other.getPosition());
+    setModel(other.getModel());
+    return *this;
+}
 Entity::~Entity()
 {
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
+    for(BaseEntity *child: children)  // they become roots
+        if(child->parent == this)
+            child->parent = nullptr;
+    getTransforms().destroy(transformID);
+}
+const Mesh &Entity::getMesh() const
+{
+    static const Mesh empty;
+    return mesh ? *mesh : empty;
+}
+Mesh &Entity::editMesh()
+{
+    if(!mesh)
+        mesh = std::make_shared<Mesh>();
+    else if(mesh.use_count() > 1)  // copy-on-write
+        mesh = std::make_shared<Mesh>(*mesh);
+    mesh->mergedStale = mesh->buffersStale = true;
+    return *mesh;
+}
+Mesh &Entity::editMesh(size_t first, size_t count)
+{
+    if(!mesh || mesh.use_count() > 1)  // a new copy is merged in full anyway
+        return editMesh();
+    mesh->markDirty(first, count);
+    return *mesh;
 }
 void Entity::translate(const glm::vec3 &d)
 {
@@ -43,12 +111,15 @@ void Entity::scale(float sx, float sy, float sz)
 }
 void Entity::transform(const glm::mat4 &m)
 {
-    model = m * model;
+    setModel(m * getModel());
 }
 void Entity::applyTransform()
 {
+    glm::mat4 model = getModel();
     glm::mat3 normal = glm::mat3(glm::transpose(glm::inverse(model)));
     glm::vec4 transformed;
+    Mesh &m = editMesh();
+    std::vector<GLfloat> &vertices = m.vertices, &normals = m.normals;
     for(int i=0, l=vertices.size(); i<l; i+=3)
     {
         transformed = model * glm::vec4(vertices[i], vertices[i+1], vertices[i+2], 1);
@@ -60,81 +131,66 @@ void Entity::applyTransform()
         normals[i+1] = transformed.y;
         normals[i+2] = transformed.z;
     }
-    model = glm::mat4();
+    setModel(glm::mat4());
 }
 void Entity::add(BaseEntity &e)
 {
     children.push_back(&e);
     e.parent = this;
+    if(e.type == ENTITY)
+        getTransforms().setParent(static_cast<Entity&>(e).transformID, transformID);
+    if(registry != nullptr)  // already in a scene
+        registry->add(e);
 }
 void Entity::mergeData()
 {
-    bool norm = !normals.empty(), uv = !uvs.empty();
-    merged.clear();
-    for(int i=0, j=0, l=vertices.size(); i<l; i+=3)
-    {
-        merged.push_back(vertices[i  ]);
-        merged.push_back(vertices[i+1]);
-        merged.push_back(vertices[i+2]);
-        if(norm)
-        {
-            merged.push_back(normals[i  ]);
-            merged.push_back(normals[i+1]);
-            merged.push_back(normals[i+2]);
-        }
-        if(uv)
-        {
-            merged.push_back(uvs[j++]);
-            merged.push_back(uvs[j++]);
-        }
-    }
+    if(mesh)
+        mesh->mergeData();
 }
 void Entity::createBuffers()
 {
-    glDeleteVertexArrays(1, &VAO);
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glDeleteBuffers(1, &VBO);
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, merged.size() * sizeof(GLfloat), &merged[0], dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-
-    bool norm = !normals.empty(), uv = !uvs.empty();
-    int stride = (norm ? uv ? 8 : 6 : uv ? 5 : 3) * sizeof(GLfloat);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    glEnableVertexAttribArray(0);
-    if(norm)
-    {
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
-        glEnableVertexAttribArray(1);
-    }
-    if(uv)
-    {
-        glVertexAttribPointer(norm ? 2 : 1, 2, GL_FLOAT, GL_FALSE, stride, (void*)((norm ? 6 : 3) * sizeof(GLfloat)));
-        glEnableVertexAttribArray(norm ? 2 : 1);
-    }
-
-    glDeleteBuffers(1, &EBO);
-    glGenBuffers(1, &EBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+    if(mesh)
+        mesh->createBuffers(dynamic);
+}
+Entity *Entity::getMeshSource()
+{
+    return this;
+}
+glm::vec3 Entity::getPosition() const
+{
+    const TransformSystem &t = getTransforms();
+    return t.position[t.index(transformID)];
+}
+void Entity::setPosition(const glm::vec3 &pos)
+{
+    getTransforms().setPosition(transformID, pos);
+}
+void Entity::setPosition(float x, float y, float z)
+{
+    setPosition(glm::vec3(x, y, z));
+}
+glm::mat4 Entity::getModel() const
+{
+    const TransformSystem &t = getTransforms();
+    return t.local[t.index(transformID)];
+}
+void Entity::setModel(const glm::mat4 &m)
+{
+    getTransforms().setLocal(transformID, m);
 }
-glm::mat4 Entity::getMatM()
+glm::mat4 Entity::getMatM() const
 {
-    if(parent == nullptr)
-        return glm::translate(glm::mat4(), position) * model;
-    else
-        return glm::translate(glm::mat4(), position) * (parent->getMatM() * model);
+    return getTransforms().getWorld(transformID);
+}
+glm::mat3 Entity::getMatN() const
+{
+    return getTransforms().getNormal(transformID);
 }
 
 Material::Material(){}//: ratios(1, -1, -1, -1) {}
 Material::Material(float ar, float ag, float ab, float dr, float dg, float db, float sr, float sg, float sb, float sn):
     ambient(ar, ag, ab, 1), diffuse(dr, dg, db, 1), specular(sr, sg, sb, 1), shininess(sn) {}
-Material::~Material()
-{
-    glDeleteProgram(progID);
-}
+Material::~Material() = default;
 Material Material::operator+(const Material &other) const
 {
     Material res;
@@ -192,9 +248,9 @@ void Material::createTexture(const char *path)
 {
     if(path != nullptr)
         texture = stbi_load(path, &tex_width, &tex_height, &tex_channel, 0);
-    glDeleteTextures(1, &tID);
+    deleteTextures(1, &tID);
     glGenTextures(1, &tID);
-    glBindTexture(GL_TEXTURE_2D, tID);
+    bindTexture(GL_TEXTURE_2D, tID);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -210,8 +266,17 @@ void Material::createTexture(const char *path)
 //}
 GLuint Material::setShader(std::string vertexShader, std::string fragmentShader)
 {
-    glDeleteProgram(progID);
-    progID = loadShaders(vertexShader, fragmentShader);
+    submitShader(vertexShader, fragmentShader);
+    return finishShader();
+}
+void Material::submitShader(const std::string &vertexShader, const std::string &fragmentShader)
+{
+    program = ProgramRef(acquireProgram(vertexShader, fragmentShader, false));
+    progID = 0;
+}
+GLuint Material::finishShader()
+{
+    progID = finishProgram(program.id);
     mvpID = glGetUniformLocation(progID, "MVP");
     mID = glGetUniformLocation(progID, "M");
     nID = glGetUniformLocation(progID, "N");
@@ -224,12 +289,44 @@ GLuint Material::setShader(std::string vertexShader, std::string fragmentShader)
         gID = glGetUniformLocation(progID, "shininess");
         vID = glGetUniformLocation(progID, "vpos");
     }
+    lightIDs.clear();
+    GLuint frameBlock = glGetUniformBlockIndex(progID, "Frame"),
+           lightsBlock = glGetUniformBlockIndex(progID, "Lights");
+    if(frameBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(progID, frameBlock, AGL_FRAME_BINDING);
+    if(lightsBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(progID, lightsBlock, AGL_LIGHTS_BINDING);
+    else if(lightsEnabled)  // plain uniform lights; resolve the locations once, render only uses the table
+    {
+        static const std::pair<const char*, GLint LightIDs::*> members[] = {
+            {"ambient", &LightIDs::ambient}, {"diffuse", &LightIDs::diffuse}, {"specular", &LightIDs::specular},
+            {"position", &LightIDs::position}, {"spotDirection", &LightIDs::spotDirection},
+            {"spotExponent", &LightIDs::spotExponent}, {"spotCosCutoff", &LightIDs::spotCosCutoff},
+            {"constantAttenuation", &LightIDs::constantAttenuation}, {"linearAttenuation", &LightIDs::linearAttenuation},
+            {"quadraticAttenuation", &LightIDs::quadraticAttenuation}};
+        char name[64];
+        for(int i=0; ; ++i)  // stop at the first light with no active members
+        {
+            LightIDs ids;
+            bool found = false;
+            for(const auto &m: members)
+            {
+                snprintf(name, sizeof(name), "lights[%d].%s", i, m.first);
+                ids.*m.second = glGetUniformLocation(progID, name);
+                found |= ids.*m.second != -1;
+            }
+            if(!found)
+                break;
+            lightIDs.push_back(ids);
+        }
+    }
     return progID;
 }
 
-Light::Light(const glm::vec3 &pos, const glm::vec4 &color): ambient(color), diffuse(color), specular(color), position(pos, 1) {}
-Light::Light(const glm::vec3 &pos, float r, float g, float b, float a): ambient(r, g, b, a), diffuse(r, g, b, a),
-    specular(r, g, b, a), position(pos, 1) {}
+Light::Light(const glm::vec3 &pos, const glm::vec4 &color): BaseEntity(LIGHT), ambient(color), diffuse(color),
+    specular(color), position(pos, 1) {}
+Light::Light(const glm::vec3 &pos, float r, float g, float b, float a): BaseEntity(LIGHT), ambient(r, g, b, a),
+    diffuse(r, g, b, a), specular(r, g, b, a), position(pos, 1) {}
 void Light::setColor(glm::vec4 color)
 {
     ambient = diffuse = specular = color;
@@ -243,13 +340,17 @@ SharedEntity::SharedEntity(Entity &src): Entity(src)
 {
     source = &src;
 }
-void SharedEntity::mergeData() {}
+void SharedEntity::mergeData()
+{
+    mesh = source->mesh;
+}
 void SharedEntity::createBuffers()
 {
-    VAO = source->VAO;
-    VBO = source->VBO;
-    EBO = source->EBO;
-    std::cout << "called" << std::endl;
+    mesh = source->mesh;
+}
+Entity *SharedEntity::getMeshSource()
+{
+    return source;
 }
 
 const Material Material::emerald = Material(0.0215, 0.1745, 0.0215, 0.07568, 0.61424, 0.07568, 0.633, 0.727811, 0.633, 76.8);
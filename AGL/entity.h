@@ -6,11 +6,15 @@
 #include<GLES3/gl32.h>
 #include "glm/glm.hpp"
 #include "util.h"
+#include "program.h"
+#include "transform.h"
+#include "mesh.h"
 
 namespace agl {
 class Entity;
 class Light;
 class Scene;
+class Registry;
 
 /*!
  * \brief Material class for entities.
@@ -69,28 +73,46 @@ public:
 //              ratios;  // (color, texture, reflection, refraction) [0, 1] -1: disabled
     float shininess = 32;   //!< Shininess, amount of light reflected by the material.
     bool lightsEnabled = false,  //!< If true, no lighting calculations are done.
-         customShader = false;  //!< If true, Scene#prepare do not create shaders.
+         customShader = false,  //!< If true, Scene#prepare do not create shaders.
+         transparent = false;  //!< If true, drawn blended after the opaque entities, sorted back-to-front.
     int lightingModel = AGL_LIGHTING_PHONG,  //!< Type of lighting.
         tex_width   = -1,  //!< Width of texture, if used.
         tex_height  = -1,  //!< Height of texture, if used.
         tex_channel = -1;  //!< Number of channels in texture, if used.
     GLubyte *texture = nullptr;  //!< Pointer to texture data, if present.
     GLuint progID = 0,  //!< program ID
-           tID    = 0,  //!< texture ID
-           mvpID,//!< MVP matrix ID
-           mID,  //!< model matrix ID
-           nID,  //!< normal matrix ID
-           eID,  //!< emission color ID
-           aID,  //!< ambient color ID
-           dID,  //!< diffuse color ID
-           sID,  //!< specular color ID
-           gID,  //!< shininess color ID
-           vID;  //!< camera position ID
+           tID    = 0;  //!< texture ID
+    ProgramRef program;  //!< Shared reference to #progID; copies of the material share the program.
+    GLint mvpID = -1,  //!< MVP matrix ID, only for custom shaders; generated shaders use \c VP from the \c Frame block
+          mID = -1,  //!< model matrix ID
+          nID = -1,  //!< normal matrix ID
+          eID = -1,  //!< emission color ID
+          aID = -1,  //!< ambient color ID
+          dID = -1,  //!< diffuse color ID
+          sID = -1,  //!< specular color ID
+          gID = -1,  //!< shininess color ID
+          vID = -1;  //!< camera position ID, only for custom shaders; generated shaders use \c vpos from the \c Frame block
+    /*!
+     * \brief Uniform locations for the members of a single light.
+     */
+    struct LightIDs
+    {
+        GLint ambient, diffuse, specular, position, spotDirection, spotExponent, spotCosCutoff, constantAttenuation,
+              linearAttenuation, quadraticAttenuation;
+    };
+    std::vector<LightIDs> lightIDs;  //!< Uniform locations for each light, only for programs without the \c Lights block.
 
     /*!
      * \brief Creates a material.
      */
     Material();
+    Material(const Material&) = default;
+    /*!
+     * \brief Move a material, taking over its #program reference without touching the reference count.
+     */
+    Material(Material&&) = default;
+    Material &operator=(const Material&) = default;
+    Material &operator=(Material&&) = default;
     ~Material();
 
     /*!
@@ -145,9 +167,12 @@ public:
      * \brief Create a shader algorithmically.
      * \param e Entity, needed for which to create the position based coloring.
      * \param lights All the lights in the scene.
+     * \param instanced If \c true, the model matrix, normal matrix and emission are read from per-instance vertex
+     * attributes starting at #AGL_INSTANCE_ATTRIB instead of uniforms.
      * \return The generated vertex and fragment shader.
      */\
-    virtual std::pair<std::string, std::string> createShader(Entity *e=nullptr, std::vector<Light*> lights=std::vector<Light*>());
+    virtual std::pair<std::string, std::string> createShader(Entity *e=nullptr, std::vector<Light*> lights=std::vector<Light*>(),
+                                                             bool instanced=false);
     /*!
      * \brief Compile and set the shader for the material.
      * \param vertexShader Vertex shader.
@@ -155,9 +180,29 @@ public:
      * \return The program ID of the loaded program.
      *
      * This can load shaders that were created by #createShader or those loaded manually. This will also set all the
-     * required IDs automatically. If the shader was not set, the return value will be 0.
+     * required IDs automatically and bind the \c Lights and \c Frame uniform blocks, if present, to
+     * #AGL_LIGHTS_BINDING and #AGL_FRAME_BINDING. If the shader was not set, the return value will be 0.
+     *
+     * The program is taken from the program cache (see #acquireProgram), so materials with identical shaders share a
+     * single program.
      */
     virtual GLuint setShader(std::string vertexShader, std::string fragmentShader);
+    /*!
+     * \brief Start compiling the shader for the material, without waiting for it.
+     * \param vertexShader Vertex shader.
+     * \param fragmentShader Fragment shader.
+     *
+     * This is the first half of #setShader. #progID stays 0 until #finishShader is called. Scene#prepare submits all
+     * the shaders first and finishes them afterwards, so the driver can compile them in parallel.
+     */
+    void submitShader(const std::string &vertexShader, const std::string &fragmentShader);
+    /*!
+     * \brief Finish the shader started by #submitShader.
+     * \return The program ID, or 0 if the program failed to link.
+     *
+     * This waits for the program, if needed, and sets all the IDs like #setShader.
+     */
+    GLuint finishShader();
 
     /*!
      * \defgroup predefined_materials Predefined materials
@@ -182,40 +227,59 @@ private:
 class BaseEntity
 {
 public:
+    /*!
+     * \brief What a BaseEntity actually is.
+     */
+    enum Type
+    {
+        ENTITY,  //!< An Entity, or a class derived from it.
+        LIGHT  //!< A Light.
+    };
+
+    const Type type;  //!< What this is, so that it can be told apart without RTTI.
     Entity *parent = nullptr;  //!< Parent of the entity, whose child this is. All transformations of the parent is also applied to the child.
+    Registry *registry = nullptr;  //!< The Registry of the Scene this is in, if any.
+    uint32_t registryIndex = 0;  //!< Index in the pools of the #registry.
+
+    /*!
+     * \brief Create a BaseEntity.
+     * \param type What the derived class is.
+     */
+    explicit BaseEntity(Type type);
+    /*!
+     * \brief Copy the #parent, but not the #registry; the copy is in no Scene.
+     */
+    BaseEntity(const BaseEntity &other);
+    /*!
+     * \brief Copy the #parent, but keep the #registry.
+     */
+    BaseEntity &operator=(const BaseEntity &other);
+    /*!
+     * \brief Removes itself from the #registry.
+     */
     virtual ~BaseEntity();
 };
 
 /*!
  * \brief The Entity; basically all visible objects in AGL.
  *
- * Entity consists of anything that is visible on the scene. The entities consists of
- * - #vertices: Each vertex is a point on the 3D coordinate. A shape consists of multiple vertices connected by edges.
- *   Three such adjacent edges (ie. three vertices) combines to form a triangular face of the entity.
- * - #normals: Each of the #vertices can consist of a normal, a 3D vector pointing perpendicularly away from the surface
- *   that defines the surface and possibly it's orientation. Normals are generally used for lighting calculations.
- * - #uvs (texture coordinates): Each of the vertices can also contain a 2D texture coordinate. This is used to map a
- *   texture on the surface of the entity.
- * - #indices: Indices are a set of triplets of index, each defining a face of the entity. Since an entity can only have
- *   triangular faces with three vertices, each triplet of indices defines a single face. The index is formed with the
- *   0-indexed position of the vertices. For example, a triplet of (0, 1, 2) defines the face formed by the vertices at
- *   the first, second and third position in the #vertices array.
+ * Entity consists of anything that is visible on the scene. Its geometry is a Mesh, see there for the vertices,
+ * normals, uvs and indices. The Mesh is shared by the copies of the entity and copied only when one of them is edited
+ * with #editMesh, so copying an entity is cheap. Moving an entity also moves its Mesh and Material.
  */
-class Entity: virtual public BaseEntity
+class Entity: public BaseEntity
 {
 public:
-    GLuint VAO = 0,  //!< Vertex array
-           VBO = 0,  //!< Vertex buffer
-           EBO = 0;  //!< Index buffer
-//           polyMode = GL_FILL;
-    bool dynamic = false;  //!< If true, the material is dynamic, ie. vertices might change during runtime.
-    std::vector<GLfloat> vertices,  //!< Vertices
-                         normals,  //!< Normals
-                         uvs,  //!< Texture coordinates
-                         merged;  //!< The final combination of vertices, normals, and uvs.
-    std::vector<GLuint> indices;  //!< Indices
-    glm::vec3 position;  //!< Position of the entity, the entity is centered here.
-    glm::mat4 model;  //!< The model matrix for the entity. This is the M part of the MVP matrix. This is responsible for all the transformations of this entity.
+//    GLuint polyMode = GL_FILL;
+    static constexpr uint32_t NO_BATCH = 0xFFFFFFFF;  //!< #batchIndex of an entity drawn on its own.
+
+    bool dynamic = false;  //!< If true, the vertices might change during runtime; Scene#render uploads the edits.
+    std::shared_ptr<Mesh> mesh;  //!< The geometry, possibly shared with other entities; \c null while empty.
+    int retention = -1;  //!< Mesh::Retention applied once the mesh is uploaded, or -1 for the Scene#retention.
+    uint32_t transformID;  //!< Slot of the position and model matrix of the entity in getTransforms().
+    uint32_t sceneIndex = 0,  //!< Index in Scene#entities, or in the entities waiting for the next Scene#render.
+             drawIndex = 0,  //!< Index in the single draws of the Scene, or in InstanceBatch#entities.
+             batchIndex = NO_BATCH;  //!< Index of the InstanceBatch drawing the entity, or #NO_BATCH.
     Material material;  //!< Material for shading this entity.
     std::vector<BaseEntity*> children;  //!< Children of this entity.
 
@@ -225,12 +289,81 @@ public:
      */
     Entity(const glm::vec3 &pos=glm::vec3(0));
     /*!
-     * \brief Create an entity from data copied from \a other.
+     * \brief Create an entity sharing the Mesh of \a other, with a copy of its material and transform.
      * \param other Another entity for the copy constructor.
      */
     Entity(const Entity &other);
+    /*!
+     * \brief Create an entity taking the Mesh and Material of \a other, with a copy of its transform.
+     * \param other Another entity; it is left without a mesh.
+     */
+    Entity(Entity &&other);
+    /*!
+     * \brief Share the Mesh of \a other, like the copy constructor. The entity keeps its own transform slot.
+     * \param other Another entity.
+     */
+    Entity &operator=(const Entity &other);
+    /*!
+     * \brief Take the Mesh and Material of \a other, like the move constructor. The entity keeps its own transform
+     * slot.
+     * \param other Another entity.
+     */
+    Entity &operator=(Entity &&other);
     ~Entity();
 
+    /*!
+     * \brief Get the geometry, for reading.
+     * \return The #mesh, or an empty Mesh if there is none.
+     */
+    const Mesh &getMesh() const;
+    /*!
+     * \brief Get the geometry, for writing.
+     * \return The #mesh, copied first if it is shared with other entities.
+     *
+     * The Mesh is marked stale, so that #mergeData and #createBuffers pick up the changes. Keep the reference only as
+     * long as the entity is not copied.
+     */
+    Mesh &editMesh();
+    /*!
+     * \brief Get some of the vertices, for writing.
+     * \param first The first vertex that will change.
+     * \param count The number of vertices that will change.
+     * \return The #mesh, copied first if it is shared with other entities.
+     *
+     * Unlike #editMesh, only the range is marked dirty (see Mesh#markDirty), so that a #dynamic entity re-interleaves
+     * and uploads only those vertices on the next Scene#render. The number of vertices and their attributes must not
+     * change; use #editMesh for that.
+     */
+    Mesh &editMesh(size_t first, size_t count);
+
+    /*!
+     * \brief Get the position of the entity, the entity is centered here.
+     */
+    glm::vec3 getPosition() const;
+    /*!
+     * \brief Set the position of the entity.
+     * \param pos The position.
+     */
+    void setPosition(const glm::vec3 &pos);
+    /*!
+     * \brief Set the position of the entity.
+     * \param x The x position.
+     * \param y The y position.
+     * \param z The z position.
+     */
+    void setPosition(float x, float y, float z);
+    /*!
+     * \brief Get the model matrix of the entity, with all of its own transformations.
+     *
+     * This is the M part of the MVP matrix, without the #getPosition and the parent transformations; see #getMatM.
+     */
+    glm::mat4 getModel() const;
+    /*!
+     * \brief Set the model matrix of the entity.
+     * \param m The matrix.
+     */
+    void setModel(const glm::mat4 &m);
+
     /*!
      * \brief Translate (move,shift) the entity.
      * \param d Vector to translate by.
@@ -271,8 +404,8 @@ public:
     /*!
      * \brief Transform the vertices permanently.
      *
-     * After this operation, all the transformations will be applied to all the vertices and normals. The #model matrix
-     * will reset to an identity matrix.
+     * After this operation, all the transformations will be applied to all the vertices and normals. The #getModel
+     * matrix will reset to an identity matrix.
      */
     void applyTransform();
     /*!
@@ -281,18 +414,36 @@ public:
      */
     void add(BaseEntity &e);
     /*!
-     * \brief Merge the #vertices, #normals and #uvs into a single #merged array.
+     * \brief Merge the data of the #mesh, see Mesh#mergeData. Does nothing if it is up to date.
      */
     virtual void mergeData();
     /*!
-     * \brief Create all the buffers for rendering.
+     * \brief Create the buffers of the #mesh for rendering, see Mesh#createBuffers. Shared meshes are uploaded once.
      */
     virtual void createBuffers();
+    /*!
+     * \brief Get the Entity whose buffers are used to draw this entity.
+     * \return This entity.
+     */
+    virtual Entity *getMeshSource();
     /*!
      * \brief Get the model matrix.
-     * \return The model matrix after accounting for the shift due to #position and parent transformations.
+     * \return The model matrix after accounting for the shift due to #getPosition and parent transformations.
+     *
+     * This is the world matrix from the TransformSystem. It is cached, and refreshed for all the entities at once by
+     * Scene#render; between the refreshes, an entity that changed is computed from its parents on the fly.
+     */
+    glm::mat4 getMatM() const;
+    /*!
+     * \brief Get the normal matrix, the inverse transpose of the upper 3x3 of #getMatM.
+     * \return The normal matrix.
+     *
+     * Scene#prepare marks the entities whose program reads the normal matrix, and those are cached by the
+     * TransformSystem. If the columns of the model matrix are orthogonal, ie. for rotations, translations and scales
+     * along the rotated axes, each column is just divided by its squared length. Only the other transforms need a real
+     * inverse.
      */
-    glm::mat4 getMatM();
+    glm::mat3 getMatN() const;
 };
 
 /*!
@@ -310,7 +461,7 @@ public:
  * - **Spotlight:** Spotlights are positioned and cast light in a cone. For a spotlight, the #spotCosCutoff should be
  *   between 0 and 1.
  */
-class Light: virtual public BaseEntity
+class Light: public BaseEntity
 {
 public:
     glm::vec4 ambient,         //!< Ambient, illuminates everything.
@@ -358,7 +509,7 @@ public:
      */
     inline glm::vec4 getPos()
     {
-        return parent == nullptr ? position : parent->getMatM() * position;
+        return parent == nullptr ? position : parent->getMatM() * position;  // cached, see TransformSystem
     }
 };
 /*!
@@ -390,18 +541,31 @@ inline Light DirectionalLight(const glm::vec3 &dir=glm::vec3(0), float r=1, floa
     l.position.w = 0;
     return l;
 }
+/*!
+ * \brief A Light as laid out in the [std140](https://www.khronos.org/opengl/wiki/Interface_Block_(GLSL)#Memory_layout)
+ * \c Lights uniform block.
+ *
+ * Scene#render fills an array of these once per frame and uploads it to the uniform buffer bound at
+ * #AGL_LIGHTS_BINDING, which is shared by all the generated shaders. The order of the members must match the \c Light
+ * struct in Material#createShader.
+ */
+struct LightBlock
+{
+    glm::vec4 ambient, diffuse, specular, position;
+    glm::vec3 spotDirection;
+    float spotExponent, spotCosCutoff, constantAttenuation, linearAttenuation, quadraticAttenuation;
+};
+static_assert(sizeof(LightBlock) == 96, "LightBlock must match the std140 layout of Light");
 //! @}
 
 /*!
  * \brief A SharedEntity shares its data off another Entity.
  *
- * Since all entities need their separate data, they also create their separate buffers. Say, you've two cubes, they'll
- * have the same vertex data, but will be loaded twice. SharedEntity intends to optimize this by using the buffers from
- * another Entity whose data has already been loaded. The #source entity's buffers must have been created before
- * they can be used.
- * \warning This class is unstable and might be removed in future.
+ * Unlike a plain copy, which keeps the Mesh the original had when it was copied, a SharedEntity follows the Mesh of its
+ * #source, even after the source is edited. The #source entity's data must have been merged before it can be used.
+ * \warning This class is unstable and might be removed in future; copies of an Entity share their Mesh anyway.
  */
-class SharedEntity: virtual public Entity
+class SharedEntity: public Entity
 {
 public:
     Entity *source = nullptr;  //!< The source Entity whose data and buffers are used.
@@ -412,17 +576,20 @@ public:
      */
     SharedEntity(Entity &src);
     /*!
-     * \brief Does nothing. Everything is done by #source's Entity#mergeData.
+     * \brief Takes the Mesh of the #source. Everything else is done by #source's Entity#mergeData.
+     *
+     * Scene#prepare merges the data of all the sources before that of the entities sharing them.
      */
     virtual void mergeData();
     /*!
-     * \brief Does nothing. Copies the buffers created by #source's Entity#createBuffers.
-     *
-     * For this to work, the #source's buffer must have been create before this is called. This must either be done
-     * manually, or the Entity tree must be arranged in such a way that the DFS traversal in Scene#prepare gets to the
-     * #source before itself.
+     * \brief Takes the Mesh of the #source, whose buffers were created by #source's Entity#createBuffers.
      */
     virtual void createBuffers();
+    /*!
+     * \brief Get the Entity whose buffers are used to draw this entity.
+     * \return The #source.
+     */
+    virtual Entity *getMeshSource();
 };
 }
 
@@ -0,0 +1,239 @@
+#include "gl_state.h"
+
+namespace agl {
+namespace {
+const GLuint UNKNOWN = ~0u;
+const int TEXTURE_UNITS = 32, UNIFORM_BINDINGS = 16;
+enum BufferTarget {ARRAY, ELEMENT_ARRAY, UNIFORM, PIXEL_PACK, BUFFER_TARGETS};
+
+struct State
+{
+    GLuint program, vao, unit, textures[TEXTURE_UNITS], buffers[BUFFER_TARGETS], uniforms[UNIFORM_BINDINGS];
+    int depthTest, cullFace, blend, depthWrite;  // -1: unknown
+    GLenum depthFunc, cullMode, blendSrc, blendDst;
+    float clear[4];
+};
+State state;
+GLStateStats current, last;
+bool initialized = false;
+
+void init()
+{
+    if(!initialized)
+        invalidateGLState();
+}
+bool filter(bool same, int &counter)
+{
+    init();
+    if(same)
+    {
+        ++counter;
+        ++current.filtered;
+    }
+    else
+        ++current.issued;
+    return same;
+}
+int bufferIndex(GLenum target)
+{
+    switch(target)
+    {
+    case GL_ARRAY_BUFFER:
+        return ARRAY;
+    case GL_ELEMENT_ARRAY_BUFFER:
+        return ELEMENT_ARRAY;
+    case GL_UNIFORM_BUFFER:
+        return UNIFORM;
+    case GL_PIXEL_PACK_BUFFER:
+        return PIXEL_PACK;
+    }
+    return -1;
+}
+int *capability(GLenum cap)
+{
+    switch(cap)
+    {
+    case GL_DEPTH_TEST:
+        return &state.depthTest;
+    case GL_CULL_FACE:
+        return &state.cullFace;
+    case GL_BLEND:
+        return &state.blend;
+    }
+    return nullptr;
+}
+}
+
+void invalidateGLState()
+{
+    initialized = true;
+    state.program = state.vao = state.unit = UNKNOWN;
+    for(GLuint &t: state.textures)
+        t = UNKNOWN;
+    for(GLuint &b: state.buffers)
+        b = UNKNOWN;
+    for(GLuint &b: state.uniforms)
+        b = UNKNOWN;
+    state.depthTest = state.cullFace = state.blend = state.depthWrite = -1;
+    state.depthFunc = state.cullMode = state.blendSrc = state.blendDst = UNKNOWN;
+    state.clear[0] = -1;  // colors are never negative
+}
+GLStateStats getGLStateStats()
+{
+    return last;
+}
+void endGLStateFrame()
+{
+    last = current;
+    current = GLStateStats();
+}
+
+void useProgram(GLuint progID)
+{
+    if(filter(state.program == progID, current.programs))
+        return;
+    glUseProgram(state.program = progID);
+}
+void bindVertexArray(GLuint vao)
+{
+    if(filter(state.vao == vao, current.vertexArrays))
+        return;
+    glBindVertexArray(state.vao = vao);
+    state.buffers[ELEMENT_ARRAY] = UNKNOWN;
+}
+void activeTexture(GLenum unit)
+{
+    if(filter(state.unit == unit, current.textures))
+        return;
+    glActiveTexture(state.unit = unit);
+}
+void bindTexture(GLenum target, GLuint tex)
+{
+    init();
+    int unit = state.unit == UNKNOWN ? -1 : state.unit - GL_TEXTURE0;
+    if(target != GL_TEXTURE_2D || unit < 0 || unit >= TEXTURE_UNITS)
+    {
+        ++current.issued;
+        glBindTexture(target, tex);
+        return;
+    }
+    if(filter(state.textures[unit] == tex, current.textures))
+        return;
+    glBindTexture(target, state.textures[unit] = tex);
+}
+void bindBuffer(GLenum target, GLuint buffer)
+{
+    init();
+    int i = bufferIndex(target);
+    if(i < 0)
+    {
+        ++current.issued;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if(filter(state.buffers[i] == buffer, current.buffers))
+        return;
+    glBindBuffer(target, state.buffers[i] = buffer);
+}
+void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    init();
+    if(target != GL_UNIFORM_BUFFER || index >= UNIFORM_BINDINGS)
+    {
+        ++current.issued;
+        glBindBufferBase(target, index, buffer);
+        int i = bufferIndex(target);
+        if(i >= 0)
+            state.buffers[i] = buffer;
+        return;
+    }
+    if(filter(state.uniforms[index] == buffer, current.buffers))
+        return;
+    glBindBufferBase(target, index, state.uniforms[index] = buffer);
+    state.buffers[UNIFORM] = buffer;
+}
+void setCapability(GLenum cap, bool enable)
+{
+    init();
+    int *s = capability(cap);
+    if(s == nullptr)
+        ++current.issued;
+    else if(filter(*s == enable, current.fixed))
+        return;
+    else
+        *s = enable;
+    if(enable)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+void depthFunc(GLenum func)
+{
+    if(filter(state.depthFunc == func, current.fixed))
+        return;
+    glDepthFunc(state.depthFunc = func);
+}
+void depthMask(bool write)
+{
+    if(filter(state.depthWrite == write, current.fixed))
+        return;
+    state.depthWrite = write;
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+void cullFace(GLenum mode)
+{
+    if(filter(state.cullMode == mode, current.fixed))
+        return;
+    glCullFace(state.cullMode = mode);
+}
+void blendFunc(GLenum sfactor, GLenum dfactor)
+{
+    if(filter(state.blendSrc == sfactor && state.blendDst == dfactor, current.fixed))
+        return;
+    glBlendFunc(state.blendSrc = sfactor, state.blendDst = dfactor);
+}
+void clearColor(float r, float g, float b, float a)
+{
+    float *c = state.clear;
+    if(filter(c[0] == r && c[1] == g && c[2] == b && c[3] == a, current.fixed))
+        return;
+    c[0] = r;
+    c[1] = g;
+    c[2] = b;
+    c[3] = a;
+    glClearColor(r, g, b, a);
+}
+void deleteVertexArrays(GLsizei n, const GLuint *vaos)
+{
+    for(int i=0; i<n; ++i)
+        if(vaos[i] != 0 && vaos[i] == state.vao)
+        {
+            state.vao = 0;  // GL reverts to the default vertex array
+            state.buffers[ELEMENT_ARRAY] = UNKNOWN;
+        }
+    glDeleteVertexArrays(n, vaos);
+}
+void deleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    for(int i=0; i<n; ++i)
+        if(buffers[i] != 0)
+        {
+            for(GLuint &b: state.buffers)
+                if(b == buffers[i])
+                    b = 0;
+            for(GLuint &b: state.uniforms)
+                if(b == buffers[i])
+                    b = 0;
+        }
+    glDeleteBuffers(n, buffers);
+}
+void deleteTextures(GLsizei n, const GLuint *textures)
+{
+    for(int i=0; i<n; ++i)
+        if(textures[i] != 0)
+            for(GLuint &t: state.textures)
+                if(t == textures[i])
+                    t = 0;
+    glDeleteTextures(n, textures);
+}
+}
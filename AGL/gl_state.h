@@ -0,0 +1,121 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include<GLES3/gl32.h>
+
+namespace agl {
+/*!
+ * \name GL state cache
+ * These functions shadow the GL state that AGL changes and skip the calls that would not change anything. All of AGL
+ * goes through them, so the shadow is exact as long as the application does the same, or calls #invalidateGLState
+ * after changing the state directly. The shadow is for the single context of the Scene.
+ * @{
+ */
+/*!
+ * \brief Counters of the state cache for one frame.
+ *
+ * \sa getGLStateStats
+ */
+struct GLStateStats
+{
+    int issued = 0,  //!< Calls passed on to GL.
+        filtered = 0,  //!< Calls skipped, the sum of the counters below.
+        programs = 0,  //!< Skipped #useProgram.
+        vertexArrays = 0,  //!< Skipped #bindVertexArray.
+        textures = 0,  //!< Skipped #activeTexture and #bindTexture.
+        buffers = 0,  //!< Skipped #bindBuffer and #bindBufferBase.
+        fixed = 0;  //!< Skipped capability, depth, cull, blend and clear color changes.
+};
+/*!
+ * \brief Forget the shadowed state.
+ *
+ * Every following call is issued once, and the state is shadowed again from there. Call this after changing the state
+ * with GL directly, or when a new context is made current.
+ */
+void invalidateGLState();
+/*!
+ * \brief Get the counters of the last frame.
+ * \return The counters, as of the last #endGLStateFrame.
+ */
+GLStateStats getGLStateStats();
+/*!
+ * \brief End a frame of the counters. Scene#render and Scene#render2D call this after swapping the buffers.
+ */
+void endGLStateFrame();
+
+/*!
+ * \brief Cached \c glUseProgram.
+ */
+void useProgram(GLuint progID);
+/*!
+ * \brief Cached \c glBindVertexArray.
+ *
+ * The \c GL_ELEMENT_ARRAY_BUFFER binding is part of the vertex array, so it is forgotten when the vertex array changes.
+ */
+void bindVertexArray(GLuint vao);
+/*!
+ * \brief Cached \c glActiveTexture.
+ * \param unit The texture unit, eg. \c GL_TEXTURE0.
+ */
+void activeTexture(GLenum unit);
+/*!
+ * \brief Cached \c glBindTexture on the active unit.
+ * \param target The target. Only \c GL_TEXTURE_2D on the first 32 units is shadowed, others are always issued.
+ * \param tex The texture ID.
+ */
+void bindTexture(GLenum target, GLuint tex);
+/*!
+ * \brief Cached \c glBindBuffer.
+ * \param target \c GL_ARRAY_BUFFER, \c GL_ELEMENT_ARRAY_BUFFER, \c GL_UNIFORM_BUFFER or \c GL_PIXEL_PACK_BUFFER are
+ * shadowed, others are always issued.
+ * \param buffer The buffer ID.
+ */
+void bindBuffer(GLenum target, GLuint buffer);
+/*!
+ * \brief Cached \c glBindBufferBase for the first 16 uniform buffer bindings.
+ *
+ * This also binds \a buffer to the generic \a target, as GL does.
+ */
+void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+/*!
+ * \brief Cached \c glEnable and \c glDisable.
+ * \param cap \c GL_DEPTH_TEST, \c GL_CULL_FACE or \c GL_BLEND are shadowed, others are always issued.
+ * \param enable Enable or disable?
+ */
+void setCapability(GLenum cap, bool enable);
+/*!
+ * \brief Cached \c glDepthFunc.
+ */
+void depthFunc(GLenum func);
+/*!
+ * \brief Cached \c glDepthMask.
+ */
+void depthMask(bool write);
+/*!
+ * \brief Cached \c glCullFace.
+ */
+void cullFace(GLenum mode);
+/*!
+ * \brief Cached \c glBlendFunc.
+ */
+void blendFunc(GLenum sfactor, GLenum dfactor);
+/*!
+ * \brief Cached \c glClearColor.
+ */
+void clearColor(float r, float g, float b, float a);
+/*!
+ * \brief \c glDeleteVertexArrays that also forgets the deleted vertex arrays, so their names can be reused.
+ */
+void deleteVertexArrays(GLsizei n, const GLuint *vaos);
+/*!
+ * \brief \c glDeleteBuffers that also forgets the deleted buffers, so their names can be reused.
+ */
+void deleteBuffers(GLsizei n, const GLuint *buffers);
+/*!
+ * \brief \c glDeleteTextures that also forgets the deleted textures, so their names can be reused.
+ */
+void deleteTextures(GLsizei n, const GLuint *textures);
+//! @}
+}
+
+#endif // GL_STATE_H
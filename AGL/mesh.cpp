@@ -0,0 +1,289 @@
+#include "mesh.h"
+#include "gl_state.h"
+#include "ring_buffer.h"
+#include<algorithm>
+#include<cstring>
+#include<cmath>
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+#include<xmmintrin.h>
+#endif
+
+namespace agl {
+namespace {
+/*
+ * Interleave count vertices into out, with the layout fixed at compile time, and return their bounds. With SSE each
+ * attribute is copied with one unaligned 4-float store, whose extra lane is overwritten by the next store; the last
+ * vertex is copied one float at a time, so that nothing is read or written past the ends.
+ */
+template<bool norm, bool uv>
+void interleave(const GLfloat *v, const GLfloat *n, const GLfloat *t, size_t count, GLfloat *out, glm::vec3 &mn,
+                glm::vec3 &mx)
+{
+    const size_t stride = 3 + (norm ? 3 : 0) + (uv ? 2 : 0);
+    mn = mx = count == 0 ? glm::vec3(0) : glm::vec3(v[0], v[1], v[2]);
+    size_t i = 0;
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+    if(count > 1)
+    {
+        __m128 lo = _mm_loadu_ps(v), hi = lo;
+        for(; i<count-1; ++i, v+=3, out+=stride)
+        {
+            __m128 p = _mm_loadu_ps(v);
+            lo = _mm_min_ps(lo, p);
+            hi = _mm_max_ps(hi, p);
+            _mm_storeu_ps(out, p);
+            if(norm)
+            {
+                _mm_storeu_ps(out + 3, _mm_loadu_ps(n));
+                n += 3;
+            }
+            if(uv)
+            {
+                _mm_storel_pi((__m64*)(out + (norm ? 6 : 3)), _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)t));
+                t += 2;
+            }
+        }
+        float l[4], h[4];
+        _mm_storeu_ps(l, lo);
+        _mm_storeu_ps(h, hi);
+        mn = glm::vec3(l[0], l[1], l[2]);
+        mx = glm::vec3(h[0], h[1], h[2]);
+    }
+#endif
+    for(; i<count; ++i, v+=3, out+=stride)
+    {
+        for(int k=0; k<3; ++k)
+        {
+            out[k] = v[k];
+            mn[k] = std::min(mn[k], v[k]);
+            mx[k] = std::max(mx[k], v[k]);
+        }
+        if(norm)
+        {
+            std::memcpy(out + 3, n, 3 * sizeof(GLfloat));
+            n += 3;
+        }
+        if(uv)
+        {
+            std::memcpy(out + (norm ? 6 : 3), t, 2 * sizeof(GLfloat));
+            t += 2;
+        }
+    }
+}
+/*
+ * Largest squared distance of count vertices from c.
+ */
+float maxDistance2(const GLfloat *v, size_t count, const glm::vec3 &c)
+{
+    float res = 0;
+    for(size_t i=0; i<count; ++i, v+=3)
+    {
+        float x = v[0] - c.x, y = v[1] - c.y, z = v[2] - c.z;
+        res = std::max(res, x*x + y*y + z*z);
+    }
+    return res;
+}
+typedef void (*InterleaveFn)(const GLfloat*, const GLfloat*, const GLfloat*, size_t, GLfloat*, glm::vec3&, glm::vec3&);
+const InterleaveFn interleavers[4] = {interleave<false, false>, interleave<false, true>, interleave<true, false>,
+                                      interleave<true, true>};
+/*
+ * Write bytes of data at offset of vbo. Through the staging ring if it is mapped persistently and has room, so the
+ * driver neither copies the data nor waits for the draws still reading vbo; with glBufferSubData otherwise.
+ */
+void uploadVertices(GLuint vbo, size_t offset, size_t bytes, const void *data, RingBuffer *staging)
+{
+    size_t from = 0;
+    void *ptr = staging != nullptr && staging->persistent ? staging->allocate(bytes, from) : nullptr;
+    if(ptr == nullptr)
+    {
+        bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+        return;
+    }
+    std::memcpy(ptr, data, bytes);
+    bindBuffer(GL_COPY_READ_BUFFER, staging->buffer);
+    bindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from, offset, bytes);
+}
+}
+
+Mesh::Mesh(const Mesh &other): vertices(other.vertices), normals(other.normals), uvs(other.uvs), merged(other.merged),
+    indices(other.indices), mergedStale(other.mergedStale || other.retained != KEEP_ALL),
+    withNormals(other.withNormals), withUVs(other.withUVs), boundsMin(other.boundsMin), boundsMax(other.boundsMax),
+    sphereCenter(other.sphereCenter), sphereRadius(other.sphereRadius), retained(other.retained) {}
+Mesh::~Mesh()
+{
+    deleteVertexArrays(1, &VAO);
+    deleteBuffers(1, &VBO);
+    deleteBuffers(1, &EBO);
+}
+size_t Mesh::mergedSize() const
+{
+    return vertices.size() / 3 * (3 + (normals.empty() ? 0 : 3) + (uvs.empty() ? 0 : 2));
+}
+void Mesh::interleave(GLfloat *out)
+{
+    withNormals = !normals.empty();
+    withUVs = !uvs.empty();
+    interleavers[withNormals * 2 + withUVs](vertices.data(), normals.data(), uvs.data(), vertices.size() / 3, out,
+                                            boundsMin, boundsMax);
+    sphereCenter = (boundsMin + boundsMax) * 0.5f;  // tighter than the half diagonal, at the cost of a second pass
+    sphereRadius = std::sqrt(maxDistance2(vertices.data(), vertices.size() / 3, sphereCenter));
+    trianglesStale = true;
+}
+void Mesh::markDirty(size_t first, size_t count)
+{
+    if(dirtyFirst >= dirtyEnd)
+        dirtyFirst = dirtyEnd = first;
+    dirtyMerged = false;
+    dirtyFirst = std::min(dirtyFirst, first);
+    dirtyEnd = std::max(dirtyEnd, first + count);
+}
+void Mesh::mergeData()
+{
+    bool sameLayout = withNormals == !normals.empty() && withUVs == !uvs.empty() && !merged.empty() &&
+                      merged.size() == mergedSize();
+    if(!mergedStale && dirtyFirst < dirtyEnd && sameLayout)  // only the dirty vertices
+    {
+        if(dirtyMerged)
+            return;
+        size_t n = vertices.size() / 3, stride = merged.size() / n, first = std::min(dirtyFirst, n),
+               count = std::min(dirtyEnd, n) - first;
+        glm::vec3 mn, mx;
+        interleavers[withNormals * 2 + withUVs](vertices.data() + first * 3, normals.data() + first * 3,
+                                                uvs.data() + first * 2, count, merged.data() + first * stride, mn, mx);
+        if(count > 0)  // an empty range has no bounds, they would include the origin
+        {
+            boundsMin = glm::min(boundsMin, mn);  // the bounds may only grow until the next full merge
+            boundsMax = glm::max(boundsMax, mx);
+            sphereRadius = std::max(sphereRadius,
+                                    std::sqrt(maxDistance2(vertices.data() + first * 3, count, sphereCenter)));
+        }
+        dirtyMerged = true;
+        trianglesStale = true;
+        return;  // the range stays dirty until it is uploaded
+    }
+    if(!mergedStale && dirtyFirst >= dirtyEnd)
+        return;
+    merged.resize(mergedSize());  // exactly, and without reallocating if the size did not change
+    interleave(merged.data());
+    mergedStale = false;
+    buffersStale = true;
+    dirtyFirst = dirtyEnd = 0;
+    dirtyMerged = false;
+}
+void Mesh::createBuffers(bool dynamic, RingBuffer *staging)
+{
+    if(VAO == 0)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        buffersStale = true;
+    }
+    if(!buffersStale && dirtyFirst < dirtyEnd)  // upload only the dirty vertices, into the same store
+    {
+        mergeData();
+        if(!buffersStale)
+        {
+            size_t n = vertices.size() / 3, stride = merged.size() / n, end = std::min(dirtyEnd, n),
+                   first = std::min(dirtyFirst, end);
+            uploadVertices(VBO, first * stride * sizeof(GLfloat), (end - first) * stride * sizeof(GLfloat),
+                           merged.data() + first * stride, staging);
+            dirtyFirst = dirtyEnd = 0;
+            dirtyMerged = false;
+            return;
+        }
+    }
+    if(!buffersStale)
+        return;
+    bindVertexArray(VAO);  // the element array binding belongs to the vertex array
+    bindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLenum usage = dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+    size_t bytes = (mergedStale ? mergedSize() : merged.size()) * sizeof(GLfloat);
+    bool uploaded = false;
+    if(mergedStale && bytes > 0)  // interleave straight into the buffer, without filling merged
+    {
+        glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, usage);
+        void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if(ptr != nullptr)
+        {
+            interleave(static_cast<GLfloat*>(ptr));
+            uploaded = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;  // false if the data got lost
+        }
+    }
+    if(!uploaded)
+    {
+        mergeData();
+        if(bytes == vertexBytes)  // keep the store, the driver need not allocate a new one
+            uploadVertices(VBO, 0, bytes, merged.data(), staging);
+        else
+            glBufferData(GL_ARRAY_BUFFER, bytes, merged.data(), usage);
+    }
+    vertexBytes = bytes;
+    setAttributes();  // the geometry may have gained or lost normals or uvs
+    if(GLsizei(indices.size()) == indexCount)
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+    else
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    indexCount = indices.size();
+    gpuBytes = bytes + indices.size() * sizeof(GLuint);
+    buffersStale = false;
+    dirtyFirst = dirtyEnd = 0;
+    dirtyMerged = false;
+}
+void Mesh::setAttributes() const
+{
+    bindBuffer(GL_ARRAY_BUFFER, VBO);
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    bool norm = hasNormals(), uv = hasUVs();
+    int stride = (norm ? uv ? 8 : 6 : uv ? 5 : 3) * sizeof(GLfloat);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    if(norm)
+    {
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(1);
+    }
+    if(uv)
+    {
+        glVertexAttribPointer(norm ? 2 : 1, 2, GL_FLOAT, GL_FALSE, stride, (void*)((norm ? 6 : 3) * sizeof(GLfloat)));
+        glEnableVertexAttribArray(norm ? 2 : 1);
+    }
+}
+void Mesh::release(Retention keep)
+{
+    if(buffersStale || keep <= retained)
+        return;
+    std::vector<GLfloat>().swap(merged);  // clear() keeps the capacity
+    std::vector<GLfloat>().swap(normals);
+    std::vector<GLfloat>().swap(uvs);
+    if(keep == KEEP_NONE)
+    {
+        std::vector<GLfloat>().swap(vertices);
+        std::vector<GLuint>().swap(indices);
+    }
+    retained = keep;
+    mergedStale = false;  // nothing to merge from any more; hasNormals and hasUVs keep the layout
+}
+const TriangleTree *Mesh::getTriangleTree()
+{
+    if(!trianglesStale || vertices.empty() || indices.size() < 3)  // or released, keep what was built
+        return triangleTree.get();
+    if(!triangleTree)
+        triangleTree.reset(new TriangleTree());
+    triangleTree->update(vertices, indices);
+    trianglesStale = false;
+    return triangleTree.get();
+}
+MemoryUsage Mesh::getMemoryUsage() const
+{
+    MemoryUsage res;
+    res.cpu = sizeof(Mesh) + (vertices.capacity() + normals.capacity() + uvs.capacity() + merged.capacity()) *
+              sizeof(GLfloat) + indices.capacity() * sizeof(GLuint);
+    if(triangleTree)
+        res.cpu += triangleTree->memoryUsage();
+    res.gpu = gpuBytes;
+    return res;
+}
+}
@@ -0,0 +1,187 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include<vector>
+#include<memory>
+#include<GL/gl.h>
+#include<GLES3/gl32.h>
+#include "triangle_tree.h"
+#include "glm/glm.hpp"
+
+namespace agl {
+class RingBuffer;
+
+/*!
+ * \brief Bytes of memory used by something, see Mesh#getMemoryUsage and Scene#getMemoryReport.
+ */
+struct MemoryUsage
+{
+    size_t cpu = 0,  //!< Bytes in the main memory.
+           gpu = 0;  //!< Bytes in the GPU memory, as requested from the driver.
+
+    inline MemoryUsage &operator+=(const MemoryUsage &other)
+    {
+        cpu += other.cpu;
+        gpu += other.gpu;
+        return *this;
+    }
+};
+
+/*!
+ * \brief The geometry of an Entity and its GPU buffers, shared between the copies of the Entity.
+ *
+ * The geometry consists of
+ * - #vertices: Each vertex is a point on the 3D coordinate. A shape consists of multiple vertices connected by edges.
+ *   Three such adjacent edges (ie. three vertices) combines to form a triangular face of the entity.
+ * - #normals: Each of the #vertices can consist of a normal, a 3D vector pointing perpendicularly away from the surface
+ *   that defines the surface and possibly it's orientation. Normals are generally used for lighting calculations.
+ * - #uvs (texture coordinates): Each of the vertices can also contain a 2D texture coordinate. This is used to map a
+ *   texture on the surface of the entity.
+ * - #indices: Indices are a set of triplets of index, each defining a face of the entity. Since an entity can only have
+ *   triangular faces with three vertices, each triplet of indices defines a single face. The index is formed with the
+ *   0-indexed position of the vertices. For example, a triplet of (0, 1, 2) defines the face formed by the vertices at
+ *   the first, second and third position in the #vertices array.
+ *
+ * A Mesh is reference counted by the Entity using it and treated as immutable while it is shared: Entity#editMesh
+ * gives the entity its own copy first (copy-on-write). Copying an Entity thus only copies a pointer, and all the
+ * copies are drawn from the same buffers, which are created once.
+ *
+ * Once the buffers are uploaded, the CPU copy of the geometry is only needed to edit or inspect it. #release frees it,
+ * keeping what was asked for by the Retention policy; Scene#prepare does that for the static entities.
+ */
+class Mesh
+{
+public:
+    /*!
+     * \brief What is kept on the CPU after the upload, see #release.
+     */
+    enum Retention
+    {
+        KEEP_ALL,  //!< Keep everything.
+        KEEP_POSITIONS,  //!< Keep the #vertices and #indices, eg. for picking; drop the rest.
+        KEEP_NONE  //!< Keep nothing.
+    };
+
+    std::vector<GLfloat> vertices,  //!< Vertices
+                         normals,  //!< Normals
+                         uvs,  //!< Texture coordinates
+                         merged;  //!< The final combination of vertices, normals, and uvs.
+    std::vector<GLuint> indices;  //!< Indices
+    GLuint VAO = 0,  //!< Vertex array
+           VBO = 0,  //!< Vertex buffer
+           EBO = 0;  //!< Index buffer
+    bool mergedStale = true,  //!< Must #merged be rebuilt from the geometry?
+         buffersStale = true,  //!< Must #merged and #indices be uploaded again?
+         withNormals = false,  //!< Does #merged have normals?
+         withUVs = false,  //!< Does #merged have texture coordinates?
+         dirtyMerged = false,  //!< Was the dirty range interleaved already, see #markDirty?
+         trianglesStale = true;  //!< Did the #vertices change since the #triangleTree was updated?
+    glm::vec3 boundsMin,  //!< Minimum of the #vertices, valid after #mergeData.
+              boundsMax,  //!< Maximum of the #vertices, valid after #mergeData.
+              sphereCenter;  //!< Center of a sphere around the #vertices, the center of the bounds.
+    float sphereRadius = 0;  //!< Radius of the sphere around the #vertices, valid after #mergeData.
+    GLsizei indexCount = 0;  //!< Number of indices uploaded to #EBO.
+    size_t gpuBytes = 0,  //!< Bytes uploaded to #VBO and #EBO.
+           vertexBytes = 0,  //!< Size of the data store of #VBO.
+           dirtyFirst = 0,  //!< First vertex changed since the last upload, see #markDirty.
+           dirtyEnd = 0;  //!< One past the last vertex changed since the last upload.
+    Retention retained = KEEP_ALL;  //!< What is left of the CPU data after #release.
+    std::unique_ptr<TriangleTree> triangleTree;  //!< Triangles for picking, see #getTriangleTree.
+
+    Mesh() = default;
+    /*!
+     * \brief Copy the geometry, but not the buffers; the copy creates its own. The copy of a released mesh is merged
+     * again from what was kept.
+     */
+    Mesh(const Mesh &other);
+    Mesh &operator=(const Mesh&) = delete;
+    /*!
+     * \brief Deletes the buffers.
+     */
+    ~Mesh();
+
+    /*!
+     * \brief Note that some vertices changed, without changing their number or attributes.
+     * \param first The first vertex changed.
+     * \param count The number of vertices changed.
+     *
+     * The ranges marked before the next upload are joined into one. Only that range is interleaved again by #mergeData
+     * and uploaded by #createBuffers, into the existing buffer.
+     */
+    void markDirty(size_t first, size_t count);
+    /*!
+     * \brief Merge the #vertices, #normals and #uvs into a single #merged array, if it is stale.
+     *
+     * See #interleave; #merged is resized to #mergedSize first, so it is allocated exactly once. If only a range is
+     * dirty (see #markDirty), only that range is interleaved, once until it is uploaded; the bounds and the sphere then
+     * only grow until the next full merge.
+     */
+    void mergeData();
+    /*!
+     * \brief Number of floats of the interleaved data.
+     */
+    size_t mergedSize() const;
+    /*!
+     * \brief Interleave the #vertices, #normals and #uvs into \a out, and refresh the bounds, sphere and layout.
+     * \param out Room for #mergedSize floats, eg. #merged or a mapped buffer.
+     *
+     * There is a loop for each combination of attributes, without branches per vertex, which copies the attributes
+     * with SSE when it is available.
+     */
+    void interleave(GLfloat *out);
+    /*!
+     * \brief Create the buffers, if needed, and upload the data and #indices, if they are stale.
+     * \param dynamic Hint that the data will be uploaded again, see Entity#dynamic.
+     * \param staging Optional persistently mapped RingBuffer, see RingBuffer#persistent. The edits of an uploaded
+     * buffer are then written into it and copied to #VBO on the GPU, instead of being passed to \c glBufferSubData.
+     *
+     * If #merged is stale, the data is interleaved straight into the mapped #VBO and #merged stays empty; this is how
+     * Scene#prepare uploads the meshes that are released anyway. Otherwise #merged is uploaded, with
+     * \c glBufferSubData if the size of the buffer did not change. If only a range is dirty, only that range is
+     * uploaded, and if nothing changed nothing is.
+     */
+    void createBuffers(bool dynamic=false, RingBuffer *staging=nullptr);
+    /*!
+     * \brief Bind #VBO and #EBO to the current vertex array and set the vertex attributes.
+     *
+     * This is used by #createBuffers, and by Scene to build the vertex arrays of the instanced batches.
+     */
+    void setAttributes() const;
+    /*!
+     * \brief Does the mesh have normals? This survives #release.
+     */
+    inline bool hasNormals() const
+    {
+        return mergedStale ? !normals.empty() : withNormals;
+    }
+    /*!
+     * \brief Does the mesh have texture coordinates? This survives #release.
+     */
+    inline bool hasUVs() const
+    {
+        return mergedStale ? !uvs.empty() : withUVs;
+    }
+    /*!
+     * \brief Free the CPU copy of the geometry, after it was uploaded.
+     * \param keep What to keep.
+     *
+     * Nothing is released while the buffers are stale. What was released can't come back; editing the mesh afterwards
+     * starts from what was kept.
+     */
+    void release(Retention keep);
+    /*!
+     * \brief Get a BVH over the triangles, for picking.
+     * \return The tree, or \c nullptr if there are no triangles.
+     *
+     * The tree is built on the first call, and refitted or built again when called after a merge of new #vertices. It
+     * keeps its own copy of the triangles, so it survives #release; a mesh released before it was picked has none.
+     */
+    const TriangleTree *getTriangleTree();
+    /*!
+     * \brief Get the memory used by the geometry, the buffers and the #triangleTree.
+     */
+    MemoryUsage getMemoryUsage() const;
+};
+}
+
+#endif // MESH_H
@@ -0,0 +1,153 @@
+#include "pick_buffer.h"
+#include "gl_state.h"
+#include "util.h"
+#include<cstdio>
+#include<string>
+
+namespace agl {
+namespace {
+std::string version()
+{
+    return "#version " + std::to_string(AGL_GLVERSION_MAJOR) + std::to_string(AGL_GLVERSION_MINOR) + "0 core\n";
+}
+}
+
+PickBuffer::~PickBuffer()
+{
+    destroy();
+}
+void PickBuffer::destroy()
+{
+    for(Slot &s: slots)
+    {
+        if(s.fence != nullptr)
+            glDeleteSync(s.fence);
+        deleteBuffers(1, &s.PBO);
+    }
+    slots.clear();
+    if(FBO != 0)
+        glDeleteFramebuffers(1, &FBO);
+    if(color != 0)
+        glDeleteRenderbuffers(1, &color);
+    if(depth != 0)
+        glDeleteRenderbuffers(1, &depth);
+    FBO = color = depth = 0;
+    single = ProgramRef();
+    instanced = ProgramRef();
+}
+void PickBuffer::begin()
+{
+    if(FBO == 0)
+    {
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, 1, 1);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 1, 1);
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            printf("The pick framebuffer is incomplete\n");
+
+        std::string fs = version() + "flat in uint pickID;\n"
+                                     "out uint outID;\n"
+                                     "void main() {\n"
+                                     "    outID = pickID;\n"
+                                     "}\n";
+        single = ProgramRef(acquireProgram(version() + "layout(location = 0) in vec3 vertexPos;\n"
+                                                       "uniform mat4 VP, M;\n"
+                                                       "uniform uint id;\n"
+                                                       "flat out uint pickID;\n"
+                                                       "void main() {\n"
+                                                       "    pickID = id;\n"
+                                                       "    gl_Position = VP * M * vec4(vertexPos, 1);\n"
+                                                       "}\n", fs));
+        instanced = ProgramRef(acquireProgram(version() + "layout(location = 0) in vec3 vertexPos;\n"
+                                              "layout(location = " + std::to_string(AGL_INSTANCE_ATTRIB) +
+                                              ") in mat4 M;\n"
+                                              "uniform mat4 VP;\n"
+                                              "uniform uint firstID;\n"
+                                              "flat out uint pickID;\n"
+                                              "void main() {\n"
+                                              "    pickID = firstID + uint(gl_InstanceID);\n"
+                                              "    gl_Position = VP * M * vec4(vertexPos, 1);\n"
+                                              "}\n", fs));
+        if(single.id == 0 || instanced.id == 0)
+            printf("The pick shaders could not be loaded\n");
+        singleVP = glGetUniformLocation(single.id, "VP");
+        singleM = glGetUniformLocation(single.id, "M");
+        singleID = glGetUniformLocation(single.id, "id");
+        instancedVP = glGetUniformLocation(instanced.id, "VP");
+        instancedID = glGetUniformLocation(instanced.id, "firstID");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glViewport(0, 0, 1, 1);
+    depthMask(true);
+    GLuint none[4] = {0, 0, 0, 0};
+    GLfloat far = 1;
+    glClearBufferuiv(GL_COLOR, 0, none);
+    glClearBufferfv(GL_DEPTH, 0, &far);
+}
+void PickBuffer::setSingle(const glm::mat4 &VP, const glm::mat4 &M, uint32_t id)
+{
+    useProgram(single.id);
+    glUniformMatrix4fv(singleVP, 1, GL_FALSE, &VP[0][0]);
+    glUniformMatrix4fv(singleM, 1, GL_FALSE, &M[0][0]);
+    glUniform1ui(singleID, id);
+}
+void PickBuffer::setInstanced(const glm::mat4 &VP, uint32_t firstID)
+{
+    useProgram(instanced.id);
+    glUniformMatrix4fv(instancedVP, 1, GL_FALSE, &VP[0][0]);
+    glUniform1ui(instancedID, firstID);
+}
+size_t PickBuffer::end()
+{
+    size_t slot = 0;
+    while(slot < slots.size() && slots[slot].fence != nullptr)
+        ++slot;
+    if(slot == slots.size())
+        slots.emplace_back();
+    Slot &s = slots[slot];
+    if(s.PBO == 0)
+    {
+        glGenBuffers(1, &s.PBO);
+        bindBuffer(GL_PIXEL_PACK_BUFFER, s.PBO);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ);
+    }
+    bindBuffer(GL_PIXEL_PACK_BUFFER, s.PBO);
+    glReadPixels(0, 0, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);  // into the buffer, returns at once
+    bindBuffer(GL_PIXEL_PACK_BUFFER, 0);  // saveImage reads into the client memory
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return slot;
+}
+bool PickBuffer::poll(size_t slot, uint32_t &id)
+{
+    Slot &s = slots[slot];
+    if(s.fence == nullptr)
+        return false;
+    if(glClientWaitSync(s.fence, 0, 0) == GL_TIMEOUT_EXPIRED)  // still in flight, ask again next frame
+        return false;
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+    bindBuffer(GL_PIXEL_PACK_BUFFER, s.PBO);
+    const GLuint *p = static_cast<const GLuint*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLuint),
+                                                                  GL_MAP_READ_BIT));
+    id = p == nullptr ? 0 : *p;
+    if(p != nullptr)
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+void PickBuffer::cancel(size_t slot)
+{
+    Slot &s = slots[slot];
+    if(s.fence != nullptr)
+        glDeleteSync(s.fence);
+    s.fence = nullptr;
+}
+}
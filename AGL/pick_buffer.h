@@ -0,0 +1,112 @@
+#ifndef PICK_BUFFER_H
+#define PICK_BUFFER_H
+
+#include<GL/gl.h>
+#include<GLES3/gl32.h>
+#include<vector>
+#include<cstddef>
+#include<cstdint>
+#include "program.h"
+#include "glm/glm.hpp"
+
+namespace agl {
+/*!
+ * \brief An integer render target for picking on the GPU, read back without stalling.
+ *
+ * The IDs of the objects are drawn into a single \c GL_R32UI pixel with a depth buffer, through a projection
+ * narrowed to the pixel under the cursor (see \c glm::pickMatrix), so only the objects around the cursor cost more
+ * than their vertices. #end copies the pixel into a pixel buffer object and puts a fence after the copy; #poll
+ * checks the fence without waiting and maps the buffer only once the GPU is done, a frame or two later. A synchronous
+ * \c glReadPixels, as in saveImage, would instead wait for the whole frame to finish.
+ *
+ * A pass goes
+ * \code{.cpp}
+ * ids.begin();
+ * ids.setSingle(VP, M, id);  // and draw, or
+ * ids.setInstanced(VP, firstID);  // and draw instanced
+ * size_t slot = ids.end();
+ * // later frames
+ * uint32_t id;
+ * if(ids.poll(slot, id))
+ *     ...  // 0 if nothing was drawn there
+ * \endcode
+ */
+class PickBuffer
+{
+public:
+    GLuint FBO = 0,  //!< The framebuffer.
+           color = 0,  //!< The \c GL_R32UI renderbuffer of the IDs.
+           depth = 0;  //!< The depth renderbuffer.
+    ProgramRef single,  //!< Program drawing an ID from a uniform, with the model matrix of the Entity.
+               instanced;  //!< Program drawing consecutive IDs from a base, with the matrices of the InstanceData.
+
+    PickBuffer() = default;
+    PickBuffer(const PickBuffer&) = delete;
+    PickBuffer &operator=(const PickBuffer&) = delete;
+    /*!
+     * \brief Deletes the GL objects, see #destroy.
+     */
+    ~PickBuffer();
+
+    /*!
+     * \brief Bind the framebuffer and clear it, creating everything on the first call.
+     *
+     * The viewport is set to the single pixel; the caller restores it after #end.
+     */
+    void begin();
+    /*!
+     * \brief Use the #single program.
+     * \param VP The view-projection matrix, narrowed to the pixel.
+     * \param M The model matrix.
+     * \param id The ID, nonzero.
+     */
+    void setSingle(const glm::mat4 &VP, const glm::mat4 &M, uint32_t id);
+    /*!
+     * \brief Use the #instanced program; instance \c i is drawn with the ID \a firstID + \c i.
+     * \param VP The view-projection matrix, narrowed to the pixel.
+     * \param firstID The ID of the first instance, nonzero.
+     */
+    void setInstanced(const glm::mat4 &VP, uint32_t firstID);
+    /*!
+     * \brief Start the read back of the pixel and bind the default framebuffer again.
+     * \return The slot to #poll for the ID.
+     */
+    size_t end();
+    /*!
+     * \brief Get the ID read back into a slot, if the GPU is done with it.
+     * \param slot The slot returned by #end.
+     * \param id Gets the ID, or 0 if nothing was drawn.
+     * \return \c false if the ID is not there yet; otherwise the slot is free again.
+     */
+    bool poll(size_t slot, uint32_t &id);
+    /*!
+     * \brief Free a slot without reading it.
+     * \param slot The slot returned by #end.
+     */
+    void cancel(size_t slot);
+    /*!
+     * \brief Delete the GL objects. This must happen while the context is current, ie. before the window is
+     * destroyed.
+     */
+    void destroy();
+
+private:
+    /*!
+     * \brief A pixel buffer object for one read back in flight.
+     */
+    struct Slot
+    {
+        GLuint PBO = 0;  //!< The buffer the pixel is copied into.
+        GLsync fence = nullptr;  //!< Fence after the copy, \c nullptr if the slot is free.
+    };
+
+    std::vector<Slot> slots;  //!< The slots, reused once read.
+    GLint singleVP = -1,  //!< Location of \c VP in #single.
+          singleM = -1,  //!< Location of \c M in #single.
+          singleID = -1,  //!< Location of \c id in #single.
+          instancedVP = -1,  //!< Location of \c VP in #instanced.
+          instancedID = -1;  //!< Location of \c firstID in #instanced.
+};
+}
+
+#endif // PICK_BUFFER_H
@@ -0,0 +1,212 @@
+#include "program.h"
+#include "util.h"
+#include<unordered_map>
+#include<vector>
+#include<fstream>
+#include<algorithm>
+
+namespace agl {
+namespace {
+struct CachedProgram
+{
+    GLuint id;
+    int refs;
+    int status;  // 0: submitted, 1: linked, -1: failed
+    std::string binary;  // where to store the binary once linked, if not empty
+};
+std::unordered_map<uint64_t, CachedProgram> programs;  // hash of the sources -> program
+std::unordered_map<GLuint, uint64_t> hashes;  // program -> hash of the sources
+std::string cacheDir;  // empty if the binary cache is disabled
+uint64_t driverHash = 0;  // hash of GL_VENDOR, GL_RENDERER and GL_VERSION, 0 until the first lookup
+ProgramCacheStats stats;
+const char CACHE_MAGIC[4] = {'A', 'G', 'L', 'B'};
+
+uint64_t fnv1a(const std::string &s, uint64_t h)
+{
+    for(unsigned char c: s)
+    {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+std::string binaryPath(uint64_t h)
+{
+    if(driverHash == 0)
+    {
+        const char *vendor = (const char*)glGetString(GL_VENDOR), *renderer = (const char*)glGetString(GL_RENDERER),
+                   *version = (const char*)glGetString(GL_VERSION);  // usually has the driver version
+        driverHash = hashShaders(std::string(vendor ? vendor : "") + '\n' + (renderer ? renderer : ""),
+                                 version ? version : "");
+    }
+    char name[40];
+    snprintf(name, sizeof(name), "/%016llx-%016llx.bin", (unsigned long long)h, (unsigned long long)driverHash);
+    return cacheDir + name;
+}
+GLuint loadBinary(const std::string &path)
+{
+    std::ifstream f(path, std::ios::in | std::ios::binary);
+    char magic[4];
+    GLenum format;
+    if(!f.is_open() || !f.read(magic, 4) || !std::equal(magic, magic + 4, CACHE_MAGIC) ||
+            !f.read((char*)&format, sizeof(format)))
+        return 0;
+    std::vector<char> blob((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if(blob.empty())
+        return 0;
+    GLuint progID = glCreateProgram();
+    glProgramBinary(progID, format, &blob[0], blob.size());
+    GLint res = 0;
+    glGetProgramiv(progID, GL_LINK_STATUS, &res);
+    if(!res)
+    {
+        glDeleteProgram(progID);
+        ++stats.rejected;
+        return 0;
+    }
+    ++stats.hits;
+    return progID;
+}
+void storeBinary(const std::string &path, GLuint progID)
+{
+    GLint len = 0;
+    glGetProgramiv(progID, GL_PROGRAM_BINARY_LENGTH, &len);
+    if(len <= 0)
+        return;
+    std::vector<char> blob(len);
+    GLenum format;
+    glGetProgramBinary(progID, len, &len, &format, &blob[0]);
+    std::ofstream f(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+        return;
+    f.write(CACHE_MAGIC, 4);
+    f.write((const char*)&format, sizeof(format));
+    f.write(&blob[0], len);
+    if(f)
+        ++stats.stored;
+}
+
+GLuint waitProgram(GLuint progID)
+{
+    GLuint res = finishProgram(progID);
+    if(res == 0)
+        releaseProgram(progID);  // the caller gets nothing to release
+    return res;
+}
+}
+
+uint64_t hashShaders(const std::string &vertShader, const std::string &fragShader)
+{
+    uint64_t h = fnv1a(vertShader, 0xcbf29ce484222325ULL);
+    h = (h ^ 0xff) * 0x100000001b3ULL;  // separator, so that moving text between the shaders changes the hash
+    return fnv1a(fragShader, h);
+}
+GLuint acquireProgram(const std::string &vertShader, const std::string &fragShader, bool wait)
+{
+    uint64_t h = hashShaders(vertShader, fragShader);
+    auto it = programs.find(h);
+    if(it != programs.end())
+    {
+        ++it->second.refs;
+        return wait ? waitProgram(it->second.id) : it->second.id;
+    }
+    GLuint progID = 0;
+    bool useBinary = false;
+    std::string path;
+    if(!cacheDir.empty())
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        useBinary = formats > 0;
+    }
+    if(useBinary)
+        progID = loadBinary(path = binaryPath(h));
+    if(progID != 0)
+        programs[h] = CachedProgram{progID, 1, 1, ""};
+    else
+    {
+        progID = submitShaders(vertShader, fragShader, useBinary);
+        if(useBinary)
+            ++stats.misses;
+        programs[h] = CachedProgram{progID, 1, 0, path};
+    }
+    hashes[progID] = h;
+    return wait ? waitProgram(progID) : progID;
+}
+GLuint finishProgram(GLuint progID)
+{
+    auto it = hashes.find(progID);
+    if(it == hashes.end())
+        return progID;
+    CachedProgram &prog = programs[it->second];
+    if(prog.status == 0)
+    {
+        prog.status = finishShaders(progID) != 0 ? 1 : -1;  // a failed program is kept until it's released
+        if(prog.status == 1 && !prog.binary.empty())
+            storeBinary(prog.binary, progID);
+        prog.binary.clear();
+    }
+    return prog.status == 1 ? progID : 0;
+}
+void retainProgram(GLuint progID)
+{
+    auto it = hashes.find(progID);
+    if(it != hashes.end())
+        ++programs[it->second].refs;
+}
+void releaseProgram(GLuint progID)
+{
+    auto it = hashes.find(progID);
+    if(it == hashes.end())
+        return;
+    auto prog = programs.find(it->second);
+    if(--prog->second.refs == 0)
+    {
+        glDeleteProgram(progID);
+        programs.erase(prog);
+        hashes.erase(it);
+    }
+}
+int cachedProgramCount()
+{
+    return programs.size();
+}
+void setProgramCacheDir(const char *dir)
+{
+    cacheDir = dir == nullptr ? "" : dir;
+}
+ProgramCacheStats getProgramCacheStats()
+{
+    return stats;
+}
+
+ProgramRef::ProgramRef(GLuint progID): id(progID) {}
+ProgramRef::ProgramRef(const ProgramRef &other): id(other.id)
+{
+    retainProgram(id);
+}
+ProgramRef::ProgramRef(ProgramRef &&other): id(other.id)
+{
+    other.id = 0;
+}
+ProgramRef &ProgramRef::operator=(const ProgramRef &other)
+{
+    retainProgram(other.id);  // retain first, in case of self assignment
+    releaseProgram(id);
+    id = other.id;
+    return *this;
+}
+ProgramRef &ProgramRef::operator=(ProgramRef &&other)
+{
+    if(this == &other)
+        return *this;
+    releaseProgram(id);
+    id = other.id;
+    other.id = 0;
+    return *this;
+}
+ProgramRef::~ProgramRef()
+{
+    releaseProgram(id);
+}
+}
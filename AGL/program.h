@@ -0,0 +1,122 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include<GLES3/gl32.h>
+#include<string>
+#include<cstdint>
+
+namespace agl {
+/*!
+ * \brief Hash a pair of shaders.
+ * \param vertShader The vertex shader.
+ * \param fragShader The fragment shader.
+ * \return A 64 bit [FNV-1a](https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function) hash of both
+ * the sources.
+ *
+ * The hash is stable across runs and platforms, and is used as the key for the program cache.
+ */
+uint64_t hashShaders(const std::string &vertShader, const std::string &fragShader);
+/*!
+ * \brief Get a shared program for a pair of shaders.
+ * \param vertShader The vertex shader.
+ * \param fragShader The fragment shader.
+ * \param wait If \c false, returns as soon as the compilation is submitted; see #finishProgram.
+ * \return The program ID, or 0 if the shaders could not be loaded.
+ *
+ * Programs are cached by #hashShaders of their sources. If a program for the same sources already exists, its
+ * reference count is incremented and it is returned as is, otherwise the shaders are compiled with #submitShaders. Every
+ * successful call must be paired with a #releaseProgram. Use ProgramRef to do that automatically.
+ *
+ * With \a wait set to \c false the returned program is always nonzero and must still be released, even if it later
+ * fails to link.
+ */
+GLuint acquireProgram(const std::string &vertShader, const std::string &fragShader, bool wait=true);
+/*!
+ * \brief Wait for a program from #acquireProgram to finish linking.
+ * \param progID The program ID.
+ * \return \a progID if the program linked, 0 otherwise.
+ *
+ * The status of each cached program is checked only once, so this is cheap to call for every Material sharing the
+ * program. Programs not in the cache are returned as is.
+ */
+GLuint finishProgram(GLuint progID);
+/*!
+ * \brief Add a reference to a program returned by #acquireProgram.
+ * \param progID The program ID.
+ */
+void retainProgram(GLuint progID);
+/*!
+ * \brief Remove a reference to a program.
+ * \param progID The program ID.
+ *
+ * The program is deleted when the last reference is released. Programs that were not created by #acquireProgram are
+ * left alone.
+ */
+void releaseProgram(GLuint progID);
+/*!
+ * \brief Number of distinct programs currently in the cache.
+ */
+int cachedProgramCount();
+
+/*!
+ * \brief Counters for the on-disk program binary cache.
+ *
+ * \sa setProgramCacheDir getProgramCacheStats
+ */
+struct ProgramCacheStats
+{
+    int hits = 0,  //!< Programs loaded from a cached binary.
+        misses = 0,  //!< Programs compiled because no usable binary was cached, including the rejected ones.
+        rejected = 0,  //!< Cached binaries the driver refused; these were compiled again and replaced.
+        stored = 0;  //!< Binaries written to the cache directory.
+};
+/*!
+ * \brief Enable the on-disk program binary cache.
+ * \param dir Directory to store the binaries in. It must already exist. \c nullptr disables the cache.
+ *
+ * When enabled, #acquireProgram first looks for a binary in \a dir and loads it with \c glProgramBinary. If there is
+ * none, or if the driver rejects it, the shaders are compiled and the binary is saved with \c glGetProgramBinary for
+ * the next run. The files are named after #hashShaders of the sources and a hash of the \c GL_VENDOR,
+ * \c GL_RENDERER and \c GL_VERSION strings, so another GPU or driver version looks for other files; a driver update
+ * that changes none of them relies on the driver rejecting the old binary. The cache is disabled by default, and does
+ * nothing if the driver supports no binary formats.
+ */
+void setProgramCacheDir(const char *dir);
+/*!
+ * \brief Get the hit and miss counters of the on-disk program binary cache.
+ * \return The counters since the program started.
+ */
+ProgramCacheStats getProgramCacheStats();
+
+/*!
+ * \brief A reference counted handle to a program from #acquireProgram.
+ *
+ * Copying the handle shares the program, destroying the last handle deletes it. Material keeps one of these so that
+ * copies of a material, and materials with the same generated shaders, use a single program.
+ */
+class ProgramRef
+{
+public:
+    GLuint id = 0;  //!< The program ID.
+
+    ProgramRef() = default;
+    /*!
+     * \brief Take over a reference returned by #acquireProgram.
+     * \param progID The program ID.
+     */
+    explicit ProgramRef(GLuint progID);
+    ProgramRef(const ProgramRef &other);
+    /*!
+     * \brief Take over the reference of \a other, which is left empty.
+     */
+    ProgramRef(ProgramRef &&other);
+    ProgramRef &operator=(const ProgramRef &other);
+    /*!
+     * \brief Release the current program and take over the reference of \a other, which is left empty.
+     */
+    ProgramRef &operator=(ProgramRef &&other);
+    ~ProgramRef();
+};
+}
+
+#endif // PROGRAM_H
@@ -0,0 +1,78 @@
+#include "registry.h"
+#include<cstdio>
+
+namespace agl {
+Registry::~Registry()
+{
+    clear();
+}
+void Registry::add(BaseEntity &e)
+{
+    if(e.registry == this)
+        return;
+    if(e.registry != nullptr)
+    {
+        printf("The entity is already in another scene.\n");
+        return;
+    }
+    e.registry = this;
+    if(e.type == BaseEntity::LIGHT)
+    {
+        e.registryIndex = lights.size();
+        lights.push_back(static_cast<Light*>(&e));
+        if(onAdd)
+            onAdd(e);
+        return;
+    }
+    Entity &ent = static_cast<Entity&>(e);
+    e.registryIndex = renderables.size();
+    renderables.push_back(&ent);
+    materials.push_back(&ent.material);
+    transforms.push_back(ent.transformID);
+    if(onAdd)
+        onAdd(e);
+    for(BaseEntity *child: ent.children)
+        add(*child);
+}
+void Registry::remove(BaseEntity &e)
+{
+    if(e.registry != this)
+        return;
+    erase(e);
+    if(e.type == BaseEntity::ENTITY)
+        for(BaseEntity *child: static_cast<Entity&>(e).children)
+            remove(*child);
+}
+void Registry::clear()
+{
+    for(Entity *e: renderables)
+        e->registry = nullptr;
+    for(Light *l: lights)
+        l->registry = nullptr;
+    renderables.clear();
+    materials.clear();
+    transforms.clear();
+    lights.clear();
+}
+void Registry::erase(BaseEntity &e)
+{
+    if(onRemove)
+        onRemove(e);
+    uint32_t i = e.registryIndex;
+    e.registry = nullptr;
+    if(e.type == BaseEntity::LIGHT)
+    {
+        lights[i] = lights.back();  // swap and pop
+        lights[i]->registryIndex = i;
+        lights.pop_back();
+        return;
+    }
+    renderables[i] = renderables.back();
+    materials[i] = materials.back();
+    transforms[i] = transforms.back();
+    renderables[i]->registryIndex = i;
+    renderables.pop_back();
+    materials.pop_back();
+    transforms.pop_back();
+}
+}
@@ -0,0 +1,67 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "entity.h"
+#include<vector>
+#include<cstdint>
+#include<functional>
+
+namespace agl {
+/*!
+ * \brief Densely packed pools of the components of a Scene.
+ *
+ * Every Entity and Light added to a Scene, including all the children, is registered here once. The pools are plain
+ * arrays that can be iterated linearly: #renderables, and the parallel #materials and #transforms, and #lights. The
+ * kind of each object comes from BaseEntity#type, so no RTTI is needed.
+ *
+ * Adding an object appends it to its pools, and removing it moves the last element of the pools into its place, so
+ * both are O(1) per object. The order of the pools is thus not the order the objects were added in.
+ */
+class Registry
+{
+public:
+    std::vector<Entity*> renderables;  //!< All the registered Entity.
+    std::vector<Material*> materials;  //!< Material of each of the #renderables.
+    std::vector<uint32_t> transforms;  //!< Entity#transformID of each of the #renderables.
+    std::vector<Light*> lights;  //!< All the registered Light.
+    std::function<void(BaseEntity&)> onAdd,  //!< Called for each object after it is registered.
+                                      onRemove;  //!< Called for each object before it is unregistered.
+
+    Registry() = default;
+    Registry(const Registry&) = delete;
+    Registry &operator=(const Registry&) = delete;
+    ~Registry();
+
+    /*!
+     * \brief Register an Entity or Light with all its children.
+     * \param e The Entity or Light.
+     *
+     * An object can be in a single registry at a time; objects already in another registry are skipped.
+     */
+    void add(BaseEntity &e);
+    /*!
+     * \brief Unregister an Entity or Light with all its children.
+     * \param e The Entity or Light.
+     */
+    void remove(BaseEntity &e);
+    /*!
+     * \brief Unregister everything.
+     */
+    void clear();
+    /*!
+     * \brief Is \a e registered here?
+     */
+    inline bool contains(const BaseEntity &e) const
+    {
+        return e.registry == this;
+    }
+
+    /*!
+     * \brief Unregister a single object, without its children. Used by the destructor of BaseEntity.
+     * \param e The Entity or Light.
+     */
+    void erase(BaseEntity &e);
+};
+}
+
+#endif // REGISTRY_H
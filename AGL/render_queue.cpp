@@ -0,0 +1,55 @@
+#include "render_queue.h"
+#include<cstring>
+
+namespace agl {
+namespace {
+const int STATE_BITS = 12, DEPTH_BITS = 24;
+const uint64_t STATE_MASK = (1ULL << STATE_BITS) - 1, DEPTH_MASK = (1ULL << DEPTH_BITS) - 1;
+}
+
+uint64_t packDrawState(uint32_t program, uint32_t texture, uint32_t vao)
+{
+    return (program & STATE_MASK) << (2*STATE_BITS) | (texture & STATE_MASK) << STATE_BITS | (vao & STATE_MASK);
+}
+uint64_t makeSortKey(uint64_t state, bool transparent, float depth)
+{
+    uint32_t bits = 0;
+    if(depth > 0)  // positive floats sort like their bits
+        memcpy(&bits, &depth, sizeof(bits));
+    uint64_t d = bits >> (31 - DEPTH_BITS);
+    if(transparent)
+        return 1ULL << 63 | (~d & DEPTH_MASK) << (3*STATE_BITS) | state;
+    return state << DEPTH_BITS | d;
+}
+
+void RenderQueue::clear()
+{
+    items.clear();
+}
+void RenderQueue::push(uint64_t key, uint32_t index)
+{
+    items.push_back(DrawItem{key, index});
+}
+void RenderQueue::sort()
+{
+    if(items.size() < 2)
+        return;
+    scratch.resize(items.size());
+    uint64_t diff = 0;  // bits that differ between the keys
+    for(const DrawItem &it: items)
+        diff |= it.key ^ items[0].key;
+    for(int shift=0; shift<64; shift+=8)
+    {
+        if(((diff >> shift) & 0xFF) == 0)
+            continue;
+        size_t count[257] = {0};
+        for(const DrawItem &it: items)
+            ++count[((it.key >> shift) & 0xFF) + 1];
+        for(int i=0; i<256; ++i)
+            count[i+1] += count[i];
+        for(const DrawItem &it: items)
+            scratch[count[(it.key >> shift) & 0xFF]++] = it;
+        items.swap(scratch);
+    }
+}
+}
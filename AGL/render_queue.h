@@ -0,0 +1,85 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include<vector>
+#include<cstdint>
+
+namespace agl {
+/*!
+ * \brief A draw in the RenderQueue.
+ */
+struct DrawItem
+{
+    uint64_t key;  //!< Sort key from #makeSortKey.
+    uint32_t index;  //!< Index of the draw in the owner's list.
+};
+
+/*!
+ * \brief Pack the state of a draw into the lower bits of a sort key.
+ * \param program Rank of the program.
+ * \param texture Rank of the texture.
+ * \param vao Rank of the vertex array.
+ * \return The packed state, to be passed to #makeSortKey.
+ *
+ * The ranks are small dense numbers given to the GL objects, not the GL names themselves; only the low 12 bits of each
+ * are kept.
+ */
+uint64_t packDrawState(uint32_t program, uint32_t texture, uint32_t vao);
+/*!
+ * \brief Make the sort key of a draw.
+ * \param state State from #packDrawState.
+ * \param transparent Is the draw in the transparent pass?
+ * \param depth Distance of the draw from the camera.
+ * \return The sort key.
+ *
+ * The key is laid out so that sorting the keys in ascending order gives the draw order:
+ *   - **Opaque:** <tt>0 | program | texture | VAO | depth</tt>, ie. the draws are grouped by state and, within a
+ *     state, go front-to-back for early depth rejection.
+ *   - **Transparent:** <tt>1 | ~depth | program | texture | VAO</tt>, ie. after all the opaque draws, back-to-front
+ *     for correct blending.
+ *
+ * The depth is quantized to 24 bits from the bits of the float, so buckets are finer near the camera. Negative depths
+ * (behind the camera) are clamped to 0.
+ */
+uint64_t makeSortKey(uint64_t state, bool transparent, float depth);
+/*!
+ * \brief Check if a key from #makeSortKey is in the transparent pass.
+ */
+inline bool isTransparentKey(uint64_t key)
+{
+    return key >> 63;
+}
+
+/*!
+ * \brief A list of draws sorted by their 64 bit keys.
+ *
+ * The queue is refilled every frame and sorted with a LSD [radix sort](https://en.wikipedia.org/wiki/Radix_sort) in
+ * 8 bit digits. Passes where all the keys have the same digit are skipped, so keys with few distinct states sort in
+ * only a few passes. The buffers are kept between the frames, so a steady scene doesn't allocate.
+ */
+class RenderQueue
+{
+public:
+    std::vector<DrawItem> items;  //!< The draws, in order after #sort.
+
+    /*!
+     * \brief Remove all the draws.
+     */
+    void clear();
+    /*!
+     * \brief Add a draw.
+     * \param key Sort key from #makeSortKey.
+     * \param index Index of the draw in the owner's list.
+     */
+    void push(uint64_t key, uint32_t index);
+    /*!
+     * \brief Sort the #items by their keys. The sort is stable.
+     */
+    void sort();
+
+private:
+    std::vector<DrawItem> scratch;  //!< Second buffer for the radix sort.
+};
+}
+
+#endif // RENDER_QUEUE_H
@@ -0,0 +1,119 @@
+#include "ring_buffer.h"
+#include "gl_state.h"
+#include<algorithm>
+#include<cstdio>
+
+namespace agl {
+namespace {
+BufferStorageFn bufferStorage = nullptr;
+}
+
+void setBufferStorage(BufferStorageFn fn)
+{
+    bufferStorage = fn;
+}
+
+RingBuffer::RingBuffer(GLenum target): target(target) {}
+RingBuffer::~RingBuffer()
+{
+    destroy();
+}
+void RingBuffer::destroy()
+{
+    for(GLsync &f: fences)
+    {
+        if(f != nullptr)
+            glDeleteSync(f);
+        f = nullptr;
+    }
+    deleteBuffers(1, &buffer);  // also unmaps it
+    buffer = 0;
+    mapped = nullptr;
+    frameSize = 0;
+}
+void RingBuffer::reserve(size_t bytes)
+{
+    bytes = std::max(bytes, needed);
+    needed = 0;
+    if(buffer != 0 && bytes <= frameSize)
+        return;
+    destroy();
+    frameSize = (std::max<size_t>(2 * bytes, 4096) + 255) & ~size_t(255);  // regions stay 256 byte aligned
+    glGenBuffers(1, &buffer);
+    bindBuffer(target, buffer);
+    persistent = false;
+    if(bufferStorage != nullptr)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(target, frameSize * AGL_RING_FRAMES, nullptr, flags);
+        mapped = static_cast<uint8_t*>(glMapBufferRange(target, 0, frameSize * AGL_RING_FRAMES, flags));
+        persistent = mapped != nullptr;
+        if(!persistent)  // the storage is immutable, start over with a plain buffer
+        {
+            printf("Could not map the ring buffer persistently, orphaning it each frame instead\n");
+            bufferStorage = nullptr;
+            deleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            bindBuffer(target, buffer);
+        }
+    }
+    if(!persistent)
+        glBufferData(target, frameSize, nullptr, GL_STREAM_DRAW);
+    frame = 0;
+}
+void RingBuffer::begin()
+{
+    if(buffer == 0)
+        reserve(0);
+    used = 0;
+    writing = true;
+    if(persistent)
+    {
+        GLsync &f = fences[frame];
+        if(f == nullptr)
+            return;
+        GLenum res = glClientWaitSync(f, 0, 0);
+        if(res == GL_TIMEOUT_EXPIRED)  // the GPU is still reading the region
+        {
+            ++stalls;
+            while(res == GL_TIMEOUT_EXPIRED)
+                res = glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        glDeleteSync(f);
+        f = nullptr;
+        return;
+    }
+    bindBuffer(target, buffer);
+    glBufferData(target, frameSize, nullptr, GL_STREAM_DRAW);  // orphan the store the GPU may still read
+    mapped = static_cast<uint8_t*>(glMapBufferRange(target, 0, frameSize, GL_MAP_WRITE_BIT |
+                                                    GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+}
+void *RingBuffer::allocate(size_t bytes, size_t &offset, size_t align)
+{
+    size_t start = (used + align - 1) / align * align;
+    used = start + bytes;  // also past the end, so that #reserve knows how much was needed
+    needed = std::max(needed, used);
+    if(!writing || mapped == nullptr || used > frameSize)
+        return nullptr;
+    offset = (persistent ? frame * frameSize : 0) + start;
+    return mapped + offset;
+}
+void RingBuffer::flush()
+{
+    if(persistent || mapped == nullptr)
+        return;  // coherent, the writes are visible to the following commands
+    bindBuffer(target, buffer);
+    if(glUnmapBuffer(target) == GL_FALSE)
+        printf("The data of the ring buffer got lost\n");
+    mapped = nullptr;
+}
+void RingBuffer::endFrame()
+{
+    flush();
+    writing = false;
+    if(!persistent)
+        return;
+    fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame = (frame + 1) % AGL_RING_FRAMES;
+}
+}
@@ -0,0 +1,116 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include<GL/gl.h>
+#include<GLES3/gl32.h>
+#include<cstddef>
+#include<cstdint>
+#include "util.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace agl {
+/*!
+ * \brief Signature of \c glBufferStorage.
+ */
+typedef void (*BufferStorageFn)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+/*!
+ * \brief Set the \c glBufferStorage of the current context, or \c nullptr if it has none.
+ *
+ * Scene sets this when it creates the context, if \c GL_ARB_buffer_storage or \c GL_EXT_buffer_storage is available.
+ * RingBuffer maps its buffers persistently only when it is set.
+ */
+void setBufferStorage(BufferStorageFn fn);
+
+/*!
+ * \brief A buffer for data written by the CPU every frame and read by the GPU in the same frame.
+ *
+ * The buffer is split into #AGL_RING_FRAMES regions of #frameSize bytes, one per frame in flight. Each frame the
+ * data is written with #allocate straight into the mapped region, so there is no intermediate copy, and #endFrame puts
+ * a fence after the draws reading it. A region is written again only after its fence signalled, ie. after the GPU is
+ * done with it, so the driver never has to synchronize implicitly.
+ *
+ * With \c glBufferStorage (see setBufferStorage) the buffer is mapped once, persistent and coherent. Otherwise the
+ * buffer holds a single region, which is orphaned with \c glBufferData and mapped unsynchronized at the start of every
+ * frame, and must be unmapped with #flush before the draws.
+ *
+ * A frame goes
+ * \code{.cpp}
+ * ring.reserve(bytes);  // between the frames
+ * ring.begin();
+ * void *p = ring.allocate(size, offset);  // as often as needed
+ * ring.flush();
+ * // draw, reading from ring.buffer at the offsets
+ * ring.endFrame();
+ * \endcode
+ */
+class RingBuffer
+{
+public:
+    GLenum target;  //!< Target the buffer is bound to for mapping.
+    GLuint buffer = 0;  //!< The buffer.
+    size_t frameSize = 0;  //!< Bytes of each region.
+    bool persistent = false;  //!< Is the buffer mapped persistently?
+    uint32_t stalls = 0;  //!< Number of times #begin had to wait for the GPU.
+
+    /*!
+     * \brief Create an empty ring; the buffer is created by #reserve.
+     * \param target Target the buffer is bound to for mapping, eg. \c GL_ARRAY_BUFFER.
+     */
+    explicit RingBuffer(GLenum target=GL_ARRAY_BUFFER);
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer &operator=(const RingBuffer&) = delete;
+    ~RingBuffer();
+
+    /*!
+     * \brief Make each region at least \a bytes large.
+     * \param bytes Bytes needed in a frame.
+     *
+     * If the regions are too small, or too small for the allocations that failed in the last frame, the buffer is
+     * created again with twice the size needed. Call this only between #endFrame and #begin.
+     */
+    void reserve(size_t bytes);
+    /*!
+     * \brief Start writing the next region, waiting for the GPU to be done with it if needed.
+     */
+    void begin();
+    /*!
+     * \brief Allocate bytes in the current region.
+     * \param bytes Number of bytes.
+     * \param offset Gets the offset of the allocation in #buffer.
+     * \param align Alignment of the offset.
+     * \return Where to write the data, or \c nullptr if the region is full or not mapped, ie. outside of #begin and
+     * #endFrame, or after #flush if the buffer is not #persistent. The caller then has to upload its data otherwise;
+     * the next #reserve makes room for it.
+     */
+    void *allocate(size_t bytes, size_t &offset, size_t align=16);
+    /*!
+     * \brief Make the written data visible to the GPU. Unmaps the buffer, unless it is #persistent.
+     */
+    void flush();
+    /*!
+     * \brief Fence the current region after the draws reading it, and move to the next; #flush is called if it was not.
+     */
+    void endFrame();
+    /*!
+     * \brief Delete the buffer and the fences, while the context still exists. #reserve creates them again.
+     */
+    void destroy();
+
+private:
+    uint8_t *mapped = nullptr;  //!< Start of the mapped buffer, or \c nullptr.
+    size_t used = 0,  //!< Bytes allocated in the current region.
+           needed = 0;  //!< Most bytes asked for in a frame, including the failed allocations.
+    int frame = 0;  //!< The current region.
+    bool writing = false;  //!< Between #begin and #flush?
+    GLsync fences[AGL_RING_FRAMES] = {};  //!< Fence after the last use of each region.
+
+};
+}
+
+#endif // RING_BUFFER_H
@@ -1,12 +1,32 @@
 #include "scene.h"
 #include "util.h"
+#include "gl_state.h"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/matrix_inverse.hpp"
 #include "glm/gtx/rotate_vector.hpp"
 #include "glm/gtx/projection.hpp"
-#include<sstream>
+#include<algorithm>
+#include<map>
+#include<array>
+#include<tuple>
+#include<cstddef>
+#include<cmath>
+#include<cstdint>
+#include<thread>
 
 namespace agl {
+namespace {
+/*
+ * Remove v[i] by moving the last entity into its place, and update the index of the moved one.
+ */
+void swapPop(std::vector<Entity*> &v, uint32_t i, uint32_t Entity::*index)
+{
+    v[i] = v.back();
+    v[i]->*index = i;
+    v.pop_back();
+}
+}
+
 Scene::Scene(int width, int height, const char *name)
 {
     this->width = width;
@@ -23,9 +43,22 @@ Scene::Scene(int width, int height, const char *name)
         break;
     }
     setController(defKeyCB, nullptr, nullptr, defScrollCB, defWindowSizeCB);
+    registry.onAdd = [this](BaseEntity &e) { registered(e); };
+    registry.onRemove = [this](BaseEntity &e) { unregistered(e); };
 }
 Scene::~Scene()
 {
+    registry.onAdd = nullptr;  // the members are being destroyed
+    registry.onRemove = nullptr;
+    deleteBuffers(1, &lightsUBO);
+    deleteBuffers(1, &frameUBO);
+    stream.destroy();
+    ids.destroy();
+    clearBatches();
+    spawned.clear();  // their meshes and programs need the context
+    canvas.mesh.reset();  // the same for the canvas, which is a member too
+    canvas.material.program = ProgramRef();
+    canvas.material.progID = 0;
     if(window)
         glfwDestroyWindow(window);
 }
@@ -49,21 +82,25 @@ void Scene::resetViewProjection()
     camera.view = glm::mat4();
     camera._pos = camera._lookAt = camera._up = glm::vec3();
 }
-Entity Scene::enableCanvas()
+Entity &Scene::enableCanvas()
 {
     resetViewProjection();
     children.clear();
-    Entity e;
+    registry.clear();
+    prepared = false;
+    singles.clear();
+    clearBatches();
+    added.clear();
     int verts[] = {-1,-1, 0,    -1, 1, 0,     1,-1, 0,     1, 1, 0},
         idx[] = {0, 1, 2,     1, 3, 2};
-    e.vertices.assign(verts, verts + 12);
-    e.indices.assign(idx, idx + 6);
-    e.material.customShader = true;
-    children.push_back(&e);
-    e.mergeData();
-    glBindVertexArray(e.VAO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, e.EBO);
-    return e;
+    Mesh &m = canvas.editMesh();
+    m.vertices.assign(verts, verts + 12);
+    m.indices.assign(idx, idx + 6);
+    canvas.material.customShader = true;
+    add(canvas);
+    canvas.mergeData();
+    canvas.createBuffers();
+    return canvas;
 }
 void Scene::setView(glm::mat4 &mat)
 {
@@ -87,119 +124,870 @@ void Scene::setController(GLFWkeyfun keyCallback, GLFWcursorposfun cursorPosCall
 void Scene::setBGcolor(float r, float g, float b, float a)
 {
     bgcolor = glm::vec4(r, g, b, a);
-    glClearColor(bgcolor.r, bgcolor.g, bgcolor.b, bgcolor.a);
+    clearColor(bgcolor.r, bgcolor.g, bgcolor.b, bgcolor.a);
 }
 void Scene::add(BaseEntity &e)
 {
     children.push_back(&e);
+    registry.add(e);
 }
 namespace {
-void enableLight(std::vector<BaseEntity*> &children, bool enable)
+float lt;
+}
+void Scene::enableLights(bool enable)
+{
+    for(Material *m: registry.materials)
+        m->lightsEnabled = enable;
+}
+void Scene::prepare(std::function<void(int, int)> progress)
+{
+    clearColor(bgcolor.r, bgcolor.g, bgcolor.b, bgcolor.a);
+    setCapability(GL_DEPTH_TEST, true);
+    depthFunc(GL_LESS);
+    lights = registry.lights;
+    entities = registry.renderables;
+    for(uint32_t i=0; i<entities.size(); ++i)
+        entities[i]->sceneIndex = i;
+    resizeLights();
+    singles.clear();
+    clearBatches();
+    createMeshes(entities);
+    std::vector<GLuint> programs;
+    std::vector<Entity*> newSingles;
+    std::vector<size_t> newBatches;
+    createDraws(entities, programs, newSingles, newBatches);
+    finishDraws(programs, progress, newSingles, newBatches);
+    createDrawStates();
+    prepared = true;
+    added.clear();
+    lightsChanged = false;
+}
+void Scene::remove(BaseEntity &e)
+{
+    std::vector<BaseEntity*> &siblings = e.parent == nullptr ? children : e.parent->children;
+    siblings.erase(std::remove(siblings.begin(), siblings.end(), &e), siblings.end());
+    if(e.parent != nullptr)
+    {
+        e.parent = nullptr;
+        if(e.type == BaseEntity::ENTITY)
+            getTransforms().setParent(static_cast<Entity&>(e).transformID, -1);
+    }
+    registry.remove(e);
+}
+Handle Scene::spawn(const Entity &e)
+{
+    std::unique_ptr<Entity> copy(new Entity(e));
+    Entity &ref = *copy;
+    Handle h = spawned.insert(std::move(copy));
+    registry.add(ref);  // the scene owns it, no need to find it in the children to remove it
+    return h;
+}
+Entity *Scene::get(Handle h) const
+{
+    return spawned.get(h);
+}
+bool Scene::despawn(Handle h)
+{
+    Entity *e = spawned.get(h);
+    if(e == nullptr)
+        return false;
+    if(e->parent != nullptr)
+        remove(*e);
+    else  // not in the children, see spawn
+        registry.remove(*e);
+    return spawned.remove(h);
+}
+void Scene::registered(BaseEntity &e)
+{
+    if(!prepared)
+        return;
+    if(e.type == BaseEntity::LIGHT)
+        lightsChanged = true;
+    else
+    {
+        static_cast<Entity&>(e).sceneIndex = added.size();
+        added.push_back(static_cast<Entity*>(&e));
+    }
+}
+void Scene::unregistered(BaseEntity &e)
 {
-    for(BaseEntity *e: children)
-        if(Entity *ent = dynamic_cast<Entity*>(e))
+    if(!prepared)
+        return;
+    if(e.type == BaseEntity::LIGHT)
+    {
+        // must not be read by updateLights any more; there are few lights, and the shaders are rebuilt anyway
+        lights.erase(std::remove(lights.begin(), lights.end(), static_cast<Light*>(&e)), lights.end());
+        lightsChanged = true;
+        return;
+    }
+    // the indices are checked against the lists, they are stale for entities removed before being drawn
+    Entity *ent = static_cast<Entity*>(&e);
+    for(PickRequest &p: picks)  // answered later, must not return the entity
+        std::replace(p.entities.begin(), p.entities.end(), ent, static_cast<Entity*>(nullptr));
+    uint32_t i = ent->sceneIndex;
+    if(i < added.size() && added[i] == ent)  // never drawn
+    {
+        swapPop(added, i, &Entity::sceneIndex);
+        return;
+    }
+    if(i < entities.size() && entities[i] == ent)
+        swapPop(entities, i, &Entity::sceneIndex);
+    i = ent->drawIndex;
+    if(ent->batchIndex == Entity::NO_BATCH)
+    {
+        if(i < singles.size() && singles[i] == ent)
+            swapPop(singles, i, &Entity::drawIndex);
+    }
+    else if(ent->batchIndex < batches.size() && i < batches[ent->batchIndex].entities.size() &&
+            batches[ent->batchIndex].entities[i] == ent)
+    {
+        uint32_t b = ent->batchIndex;
+        swapPop(batches[b].entities, i, &Entity::drawIndex);
+        if(batches[b].entities.empty())  // move the last batch into its place
         {
-            ent->material.lightsEnabled = enable;
-            enableLight(ent->children, enable);
+            deleteVertexArrays(1, &batches[b].VAO);
+            if(b + 1 < batches.size())
+            {
+                batches[b] = std::move(batches.back());
+                for(Entity *other: batches[b].entities)
+                    other->batchIndex = b;
+            }
+            batches.pop_back();
         }
+    }
+    drawStatesStale = boundsStale = true;  // rebuilt once by the next render, however many are removed
 }
-float lt;
+void Scene::applyChanges()
+{
+    if(!lightsChanged && added.empty())
+        return;
+    std::vector<GLuint> programs;
+    std::vector<Entity*> newSingles;
+    std::vector<size_t> newBatches;
+    if(lightsChanged)
+    {
+        lights = registry.lights;
+        resizeLights();
+        rebuildLit(programs, newSingles, newBatches);
+        lightsChanged = false;
+    }
+    std::vector<Entity*> adding;
+    adding.swap(added);
+    createMeshes(adding);
+    for(Entity *e: adding)
+    {
+        e->sceneIndex = entities.size();
+        entities.push_back(e);
+    }
+    createDraws(adding, programs, newSingles, newBatches);
+    finishDraws(programs, nullptr, newSingles, newBatches);
+    createDrawStates();
 }
-void Scene::enableLights(bool enable)
+void Scene::resizeLights()
 {
-    enableLight(children, enable);
+    if(lightsUBO == 0)
+        glGenBuffers(1, &lightsUBO);
+    lightData.resize(lights.size());
+    bindBuffer(GL_UNIFORM_BUFFER, lightsUBO);
+    size_t slots = std::max(std::max(lightSlots, lights.size()), size_t(1));
+    if(slots > lightSlots)  // custom shaders may still read the old count, so never shrink
+    {
+        glBufferData(GL_UNIFORM_BUFFER, slots * sizeof(LightBlock), nullptr, GL_DYNAMIC_DRAW);
+        lightSlots = slots;
+    }
+    LightBlock dark = {};  // no color, and no division by zero or normalizing a null vector in the shaders
+    dark.position = glm::vec4(0, 0, 1, 0);
+    dark.spotCosCutoff = -1;
+    dark.constantAttenuation = 1;
+    std::vector<LightBlock> unused(lightSlots - lights.size(), dark);
+    if(!unused.empty())
+        glBufferSubData(GL_UNIFORM_BUFFER, lights.size() * sizeof(LightBlock), unused.size() * sizeof(LightBlock),
+                        &unused[0]);
+    bindBufferBase(GL_UNIFORM_BUFFER, AGL_LIGHTS_BINDING, lightsUBO);
 }
-void Scene::prepare()
+void Scene::createMeshes(const std::vector<Entity*> &list)
 {
-    glClearColor(bgcolor.r, bgcolor.g, bgcolor.b, bgcolor.a);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    lights.clear();
-    entities.clear();
-    getAllEntity(children);
+    auto keeps = [this](const Entity *e) {
+        return e->dynamic ? Mesh::KEEP_ALL : e->retention < 0 ? retention : e->retention;
+    };
+    for(int pass=0; pass<2; ++pass)  // the meshes first, then the entities sharing them
+        for(Entity *e: list)
+            if((e->getMeshSource() == e) == (pass == 0))
+            {
+                if(keeps(e) == Mesh::KEEP_ALL)  // the others are interleaved straight into the mapped buffers
+                    e->mergeData();
+                e->createBuffers();
+            }
+    // a shared mesh keeps what the most conservative of its entities asks for
+    std::map<Mesh*, int> keep;
+    for(Entity *e: list)
+        if(e->mesh)
+        {
+            auto it = keep.insert(std::make_pair(e->mesh.get(), keeps(e))).first;
+            it->second = std::min(it->second, keeps(e));
+        }
+    for(auto &kv: keep)
+        kv.first->release(Mesh::Retention(kv.second));
+}
+MemoryReport Scene::getMemoryReport() const
+{
+    MemoryReport report;
+    std::map<const Mesh*, uint32_t> sharing;
+    for(Entity *e: entities)
+        if(e->mesh)
+            ++sharing[e->mesh.get()];
+    for(auto &kv: sharing)
+        report.total += kv.first->getMemoryUsage();
+    std::map<GLuint, MemoryUsage> textures, programs;
+    auto addMaterial = [&textures, &programs](const Material &m) {
+        if(m.tID != 0 && m.tex_width > 0 && m.tex_height > 0)
+        {
+            MemoryUsage &t = textures[m.tID];
+            size_t bytes = size_t(m.tex_width) * m.tex_height;
+            t.cpu = m.texture == nullptr ? 0 : bytes * m.tex_channel;
+            t.gpu = bytes * (m.tex_channel == 4 ? 4 : 3);
+        }
+        if(m.progID != 0 && programs.count(m.progID) == 0)
+        {
+            GLint length = 0;  // the size of the binary is the closest estimate the driver gives
+            glGetProgramiv(m.progID, GL_PROGRAM_BINARY_LENGTH, &length);
+            programs[m.progID].gpu = length;
+        }
+    };
     for(Entity *e: entities)
     {
-        e->mergeData();
-        e->createBuffers();
+        MemoryReport::EntityUsage u;
+        u.entity = e;
+        if(e->mesh)
+        {
+            u.mesh = e->mesh->getMemoryUsage();
+            u.sharing = sharing[e->mesh.get()];
+        }
+        report.entities.push_back(u);
+        addMaterial(e->material);
+    }
+    for(const InstanceBatch &b: batches)
+        addMaterial(b.material);
+    report.instances.gpu = stream.frameSize * (stream.persistent ? AGL_RING_FRAMES : 1);
+    report.total += report.instances;
+    for(auto &kv: textures)
+    {
+        report.textures.push_back(kv);
+        report.total += kv.second;
+    }
+    for(auto &kv: programs)
+    {
+        report.programs.push_back(kv);
+        report.total += kv.second;
+    }
+    return report;
+}
+void Scene::finishDraws(std::vector<GLuint> &programs, std::function<void(int, int)> progress,
+                        const std::vector<Entity*> &newSingles, const std::vector<size_t> &newBatches)
+{
+    std::sort(programs.begin(), programs.end());
+    programs.erase(std::unique(programs.begin(), programs.end()), programs.end());
+    for(int done=0, total=programs.size(); done<total; )  // finish the programs in the order they get ready
+    {
+        int before = done;
+        for(int i=done; i<total; ++i)
+            if(!progress || isProgramReady(programs[i]))
+            {
+                finishProgram(programs[i]);
+                std::swap(programs[i], programs[done++]);
+            }
+        if(!progress)
+            continue;
+        progress(done, total);  // once per pass, usually a loading frame
+        if(done == before)  // leave the core to the compiler threads
+            std::this_thread::yield();
+    }
+    TransformSystem &transforms = getTransforms();
+    for(Entity *e: newSingles)
+    {
         if(!e->material.customShader)
+            e->material.finishShader();
+        transforms.setNeedsNormal(e->transformID, e->material.nID != -1);
+    }
+    for(size_t i: newBatches)
+    {
+        InstanceBatch &b = batches[i];
+        b.material.finishShader();
+        b.normals = glGetAttribLocation(b.material.progID, "N") != -1;
+        for(Entity *e: b.entities)
+            transforms.setNeedsNormal(e->transformID, b.normals);
+    }
+}
+void Scene::rebuildLit(std::vector<GLuint> &programs, std::vector<Entity*> &newSingles,
+                       std::vector<size_t> &newBatches)
+{
+    // only the generated shaders with lights depend on the number of lights
+    for(Entity *e: singles)
+        if(!e->material.customShader && e->material.lightsEnabled)
         {
             std::pair<std::string, std::string> shaders = e->material.createShader(e, lights);
-            e->material.setShader(shaders.first, shaders.second);
+            e->material.submitShader(shaders.first, shaders.second);
+            programs.push_back(e->material.program.id);
+            newSingles.push_back(e);
         }
+    for(size_t i=0; i<batches.size(); ++i)
+    {
+        InstanceBatch &b = batches[i];
+        Entity *first = b.entities[0];
+        if(!first->material.lightsEnabled)
+            continue;
+        std::pair<std::string, std::string> shaders = first->material.createShader(first, lights);
+        std::get<1>(b.key) = hashShaders(shaders.first, shaders.second);
+        shaders = b.material.createShader(first, lights, true);
+        b.material.submitShader(shaders.first, shaders.second);
+        programs.push_back(b.material.program.id);
+        newBatches.push_back(i);
     }
 }
-bool Scene::render()
+void Scene::createDrawStates()
 {
-    std::stringstream lt;
-    glm::mat4 vp = getMatVP();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    for(Entity *e: entities)
+    drawStatesStale = false;
+    boundsStale = true;  // other entities, the tree and the grid must be built again
+    // dense ranks for the GL objects, so that they fit in the sort keys
+    std::map<GLuint, uint32_t> progs, textures, vaos;
+    auto rank = [](std::map<GLuint, uint32_t> &ranks, GLuint id) {
+        return ranks.insert(std::make_pair(id, ranks.size())).first->second;
+    };
+    drawStates.clear();
+    for(Entity *e: singles)
+        drawStates.push_back(packDrawState(rank(progs, e->material.progID),
+                                           rank(textures, e->material.texture == nullptr ? 0 : e->material.tID),
+                                           rank(vaos, e->getMesh().VAO)));
+    for(InstanceBatch &b: batches)
     {
-//        glPolygonMode(GL_FRONT_AND_BACK, e->polyMode);
-        glUseProgram(e->material.progID);
-        glm::mat4 model = e->getMatM(),
-                mvp = vp * model;
-        glUniformMatrix4fv(e->material.mvpID, 1, GL_FALSE, &mvp[0][0]);
-        glUniformMatrix4fv(e->material.mID, 1, GL_FALSE, &model[0][0]);
-        glUniformMatrix3fv(e->material.nID, 1, GL_FALSE, &glm::mat3(glm::transpose(glm::inverse(model)))[0][0]);
-        glUniform4fv(e->material.eID, 1, &e->material.emission[0]);
-        if(e->material.texture == nullptr)
-            glBindTexture(GL_TEXTURE_2D, 0);
-        else
-            glBindTexture(GL_TEXTURE_2D, e->material.tID);
-        if(e->material.lightsEnabled)
+        const Material &m = b.entities[0]->material;
+        drawStates.push_back(packDrawState(rank(progs, b.material.progID),
+                                           rank(textures, m.texture == nullptr ? 0 : m.tID), rank(vaos, b.VAO)));
+    }
+}
+void Scene::createDraws(const std::vector<Entity*> &list, std::vector<GLuint> &programs,
+                        std::vector<Entity*> &newSingles, std::vector<size_t> &newBatches)
+{
+    // entities with the same mesh, shader, texture and colors (except emission) can be drawn instanced
+    struct Group
+    {
+        std::pair<std::string, std::string> shaders;
+        std::vector<Entity*> entities;
+    };
+    std::map<BatchKey, Group> groups;
+    auto single = [&](Entity *e) {
+        e->batchIndex = Entity::NO_BATCH;
+        e->drawIndex = singles.size();
+        singles.push_back(e);
+        newSingles.push_back(e);
+    };
+    for(Entity *e: list)
+    {
+        if(e->material.customShader)
         {
-            glUniform4fv(e->material.aID, 1, &e->material.ambient[0]);
-            glUniform4fv(e->material.dID, 1, &e->material.diffuse[0]);
-            glUniform4fv(e->material.sID, 1, &e->material.specular[0]);
-            glUniform1f(e->material.gID, e->material.shininess);
-            glUniform3fv(e->material.vID, 1, &camera._pos[0]);
-            for(int i=0, l=lights.size(); i<l; ++i)
+            single(e);
+            continue;
+        }
+        std::pair<std::string, std::string> shaders = e->material.createShader(e, lights);
+        if(e->dynamic || e->material.transparent || !e->mesh)  // instances are not sorted by depth
+        {
+            e->material.submitShader(shaders.first, shaders.second);
+            programs.push_back(e->material.program.id);
+            single(e);
+            continue;
+        }
+        const Material &m = e->material;
+        std::array<float, 13> colors = {m.ambient.r, m.ambient.g, m.ambient.b, m.ambient.a, m.diffuse.r, m.diffuse.g,
+                                        m.diffuse.b, m.diffuse.a, m.specular.r, m.specular.g, m.specular.b,
+                                        m.specular.a, m.shininess};
+        BatchKey key(e->mesh.get(), hashShaders(shaders.first, shaders.second), m.tID, colors);
+        auto batch = std::find_if(batches.begin(), batches.end(), [&key](const InstanceBatch &b) {
+            return b.key == key;
+        });
+        if(batch != batches.end())  // join an existing batch, its program is ready
+        {
+            e->batchIndex = batch - batches.begin();
+            e->drawIndex = batch->entities.size();
+            batch->entities.push_back(e);
+            getTransforms().setNeedsNormal(e->transformID, batch->normals);
+            continue;
+        }
+        Group &g = groups[key];
+        if(g.entities.empty())
+            g.shaders = shaders;
+        g.entities.push_back(e);
+    }
+    for(auto &kv: groups)
+    {
+        Group &g = kv.second;
+        if(g.entities.size() < AGL_INSTANCE_MIN)
+        {
+            for(Entity *e: g.entities)
             {
-                std::stringstream().swap(lt); lt << "lights[" << i << "].ambient";
-                glUniform4fv(glGetUniformLocation(e->material.progID, lt.str().c_str()), 1, &lights[i]->ambient[0]);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].diffuse";
-                glUniform4fv(glGetUniformLocation(e->material.progID, lt.str().c_str()), 1, &lights[i]->diffuse[0]);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].specular";
-                glUniform4fv(glGetUniformLocation(e->material.progID, lt.str().c_str()), 1, &lights[i]->specular[0]);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].position";
-                glUniform4fv(glGetUniformLocation(e->material.progID, lt.str().c_str()), 1, &lights[i]->getPos()[0]);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].spotDirection";
-                glUniform3fv(glGetUniformLocation(e->material.progID, lt.str().c_str()), 1, &lights[i]->spotDirection[0]);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].spotExponent";
-                glUniform1f(glGetUniformLocation(e->material.progID, lt.str().c_str()), lights[i]->spotExponent);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].spotCosCutoff";
-                glUniform1f(glGetUniformLocation(e->material.progID, lt.str().c_str()), lights[i]->spotCosCutoff);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].constantAttenuation";
-                glUniform1f(glGetUniformLocation(e->material.progID, lt.str().c_str()), lights[i]->constantAttenuation);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].linearAttenuation";
-                glUniform1f(glGetUniformLocation(e->material.progID, lt.str().c_str()), lights[i]->linearAttenuation);
-                std::stringstream().swap(lt); lt << "lights[" << i << "].quadraticAttenuation";
-                glUniform1f(glGetUniformLocation(e->material.progID, lt.str().c_str()), lights[i]->quadraticAttenuation);
+                e->material.submitShader(g.shaders.first, g.shaders.second);
+                programs.push_back(e->material.program.id);
+                single(e);
             }
+            continue;
+        }
+        newBatches.push_back(batches.size());
+        batches.push_back(InstanceBatch());
+        InstanceBatch &b = batches.back();
+        b.key = kv.first;
+        b.mesh = g.entities[0]->mesh;
+        b.entities = g.entities;
+        for(uint32_t i=0; i<b.entities.size(); ++i)
+        {
+            b.entities[i]->batchIndex = batches.size() - 1;
+            b.entities[i]->drawIndex = i;
+        }
+        b.material = g.entities[0]->material;
+        std::pair<std::string, std::string> shaders = b.material.createShader(g.entities[0], lights, true);
+        b.material.submitShader(shaders.first, shaders.second);
+        programs.push_back(b.material.program.id);
+
+        glGenVertexArrays(1, &b.VAO);
+        bindVertexArray(b.VAO);
+        b.mesh->setAttributes();
+        for(int i=0; i<8; ++i)  // pointed into the stream by drawBatch
+        {
+            glVertexAttribDivisor(AGL_INSTANCE_ATTRIB + i, 1);
+            glEnableVertexAttribArray(AGL_INSTANCE_ATTRIB + i);
         }
-        glBindVertexArray(e->VAO);
-        if(e->dynamic)
+    }
+    bindVertexArray(0);
+}
+void Scene::clearBatches()
+{
+    for(InstanceBatch &b: batches)
+        deleteVertexArrays(1, &b.VAO);
+    batches.clear();
+}
+bool Scene::render()
+{
+    collectPicks();
+    applyChanges();
+    if(drawStatesStale)
+        createDrawStates();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    updateFrame();
+    getTransforms().update();
+    updateLights();
+    const TransformSystem &transforms = getTransforms();
+    queue.clear();
+    size_t instances = 0;
+    for(const InstanceBatch &b: batches)
+        instances += b.entities.size() * sizeof(InstanceData) + 16;  // with the alignment
+    stream.reserve(instances);
+    stream.begin();
+    cull();
+    for(int i=0, l=singles.size(); i<l; ++i)
+    {
+        if(!visible[i])
+            continue;
+        const glm::mat4 &model = transforms.world[transforms.index(singles[i]->transformID)];
+        queue.push(makeSortKey(drawStates[i], singles[i]->material.transparent, -(frameData.V * model[3]).z), i);
+    }
+    for(size_t i=0, first=singles.size(); i<batches.size(); first+=batches[i].entities.size(), ++i)
+    {
+        float depth = updateBatch(batches[i], &visible[first]);
+        if(batches[i].count > 0)
+            queue.push(makeSortKey(drawStates[singles.size() + i], false, depth), singles.size() + i);
+    }
+    stats.drawCalls = queue.items.size();
+    queue.sort();
+    stream.flush();
+
+    bool blending = false;
+    for(const DrawItem &d: queue.items)
+    {
+        if(isTransparentKey(d.key) && !blending)  // the transparent draws come last
         {
-            glBindBuffer(GL_ARRAY_BUFFER, e->VBO);
-            glBufferData(GL_ARRAY_BUFFER, e->merged.size() * sizeof(GLfloat), &e->merged[0], GL_DYNAMIC_DRAW);
+            setCapability(GL_BLEND, true);
+            blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            depthMask(false);
+            blending = true;
         }
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, e->EBO);
-        glDrawElements(GL_TRIANGLES, e->indices.size(), GL_UNSIGNED_INT, 0);
+        if(d.index < singles.size())
+            drawEntity(singles[d.index]);
+        else
+            drawBatch(batches[d.index - singles.size()]);
+    }
+    if(blending)
+    {
+        setCapability(GL_BLEND, false);
+        depthMask(true);
     }
+    drawPicks();
+    stream.endFrame();
 
     glfwSwapBuffers(window);
     glfwPollEvents();
+    endGLStateFrame();
     return glfwWindowShouldClose(window) == 0;
 }
+void Scene::drawEntity(Entity *e)
+{
+//    glPolygonMode(GL_FRONT_AND_BACK, e->polyMode);
+    useProgram(e->material.progID);
+    const TransformSystem &transforms = getTransforms();
+    uint32_t t = transforms.index(e->transformID);
+    const glm::mat4 &model = transforms.world[t];
+    if(e->material.mvpID != -1)  // only custom shaders need the full matrix
+    {
+        glm::mat4 mvp = frameData.VP * model;
+        glUniformMatrix4fv(e->material.mvpID, 1, GL_FALSE, &mvp[0][0]);
+    }
+    glUniformMatrix4fv(e->material.mID, 1, GL_FALSE, &model[0][0]);
+    if(e->material.nID != -1 && transforms.flags[t] & TransformSystem::NEEDS_NORMAL)
+        glUniformMatrix3fv(e->material.nID, 1, GL_FALSE, &transforms.normal[t][0][0]);
+    else if(e->material.nID != -1)  // a shader set after prepare, kept by the updates from now on
+    {
+        getTransforms().setNeedsNormal(e->transformID, true);
+        glm::mat3 normal = transforms.getNormal(e->transformID);
+        glUniformMatrix3fv(e->material.nID, 1, GL_FALSE, &normal[0][0]);
+    }
+    glUniform4fv(e->material.eID, 1, &e->material.emission[0]);
+    if(e->material.texture == nullptr)
+        bindTexture(GL_TEXTURE_2D, 0);
+    else
+        bindTexture(GL_TEXTURE_2D, e->material.tID);
+    if(e->material.lightsEnabled)
+    {
+        glUniform4fv(e->material.aID, 1, &e->material.ambient[0]);
+        glUniform4fv(e->material.dID, 1, &e->material.diffuse[0]);
+        glUniform4fv(e->material.sID, 1, &e->material.specular[0]);
+        glUniform1f(e->material.gID, e->material.shininess);
+        if(e->material.vID != -1)
+            glUniform3fv(e->material.vID, 1, &camera._pos[0]);
+        for(int i=0, l=std::min(lights.size(), e->material.lightIDs.size()); i<l; ++i)
+        {
+            const Material::LightIDs &ids = e->material.lightIDs[i];
+            glUniform4fv(ids.ambient, 1, &lights[i]->ambient[0]);
+            glUniform4fv(ids.diffuse, 1, &lights[i]->diffuse[0]);
+            glUniform4fv(ids.specular, 1, &lights[i]->specular[0]);
+            glUniform4fv(ids.position, 1, &lights[i]->getPos()[0]);
+            glUniform3fv(ids.spotDirection, 1, &lights[i]->spotDirection[0]);
+            glUniform1f(ids.spotExponent, lights[i]->spotExponent);
+            glUniform1f(ids.spotCosCutoff, lights[i]->spotCosCutoff);
+            glUniform1f(ids.constantAttenuation, lights[i]->constantAttenuation);
+            glUniform1f(ids.linearAttenuation, lights[i]->linearAttenuation);
+            glUniform1f(ids.quadraticAttenuation, lights[i]->quadraticAttenuation);
+        }
+    }
+    if(e->dynamic && e->mesh)  // uploads only if the mesh was edited; cull merged it already
+        e->mesh->createBuffers(true, &stream);
+    const Mesh &m = e->getMesh();
+    bindVertexArray(m.VAO);
+    glDrawElements(GL_TRIANGLES, m.indexCount, GL_UNSIGNED_INT, 0);
+}
+void Scene::updateBounds()
+{
+    const TransformSystem &transforms = getTransforms();
+    spheres.clear();
+    itemEntities.clear();
+    glm::vec3 center;
+    for(Entity *e: singles)
+    {
+        if(e->dynamic && e->mesh)
+            e->mesh->mergeData();  // refreshes the bounds of this frame's edits
+        const Mesh &m = e->getMesh();
+        float r = transformSphere(m.sphereCenter, m.sphereRadius, transforms.world[transforms.index(e->transformID)],
+                                  center);
+        spheres.push(center, r);
+        itemEntities.push_back(e);
+    }
+    for(const InstanceBatch &b: batches)
+        for(Entity *e: b.entities)
+        {
+            float r = transformSphere(b.mesh->sphereCenter, b.mesh->sphereRadius,
+                                      transforms.world[transforms.index(e->transformID)], center);
+            spheres.push(center, r);
+            itemEntities.push_back(e);
+        }
+    boundsStale = false;
+    treeStale = gridStale = true;
+}
+const BVH &Scene::getTree()
+{
+    if(boundsStale)  // the entities changed since the last render
+    {
+        getTransforms().update();
+        updateBounds();
+    }
+    if(!treeStale)
+        return tree;
+    worldMin.resize(spheres.size());
+    worldMax.resize(spheres.size());
+    for(size_t i=0; i<spheres.size(); ++i)
+    {
+        glm::vec3 c(spheres.x[i], spheres.y[i], spheres.z[i]);
+        worldMin[i] = c - spheres.r[i];
+        worldMax[i] = c + spheres.r[i];
+    }
+    if(!tree.refit(worldMin, worldMax))  // refitting is linear, a build is not
+        tree.build(worldMin, worldMax);
+    treeStale = false;
+    return tree;
+}
+const SpatialGrid &Scene::getGrid()
+{
+    if(boundsStale)
+    {
+        getTransforms().update();
+        updateBounds();
+    }
+    if(gridStale)
+        grid.build(spheres, gridCellSize);
+    gridStale = false;
+    return grid;
+}
+void Scene::cull()
+{
+    updateBounds();
+    if(useGrid)
+        getGrid();  // rebuilt every frame, the tree only when queried
+    else
+        getTree();
+    visible.assign(spheres.size(), !culling);
+    if(!culling)
+    {
+        stats.drawn = visible.size();
+        stats.culled = 0;
+        return;
+    }
+    Frustum frustum(frameData.VP);
+    if(useGrid)  // many small entities, test them all four at a time
+        stats.drawn = frustum.cull(spheres, visible.data());
+    else
+    {
+        found.clear();
+        partial.clear();
+        tree.query(frustum, found, &partial);
+        for(uint32_t i: found)
+            visible[i] = 1;
+        BoundingSpheres &test = partialSpheres;  // the entities of the leaves on the border, tested four at a time
+        test.clear();
+        for(uint32_t i: partial)
+            test.push(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.r[i]);
+        partialVisible.resize(partial.size());
+        frustum.cull(test, partialVisible.data());
+        for(size_t k=0; k<partial.size(); ++k)
+            visible[partial[k]] = partialVisible[k];
+        stats.drawn = found.size() + std::count(partialVisible.begin(), partialVisible.end(), 1);
+    }
+    stats.culled = visible.size() - stats.drawn;
+}
+void Scene::findEntities(const std::vector<uint32_t> &items, std::vector<Entity*> &res) const
+{
+    res.clear();
+    for(uint32_t i: items)
+        res.push_back(itemEntities[i]);
+}
+void Scene::query(const Frustum &f, std::vector<Entity*> &res)
+{
+    found.clear();
+    getTree().query(f, found);
+    findEntities(found, res);
+}
+void Scene::query(const glm::vec3 &boxMin, const glm::vec3 &boxMax, std::vector<Entity*> &res)
+{
+    found.clear();
+    getTree().query(boxMin, boxMax, found);
+    findEntities(found, res);
+}
+void Scene::querySphere(const glm::vec3 &center, float radius, std::vector<Entity*> &res)
+{
+    found.clear();
+    getTree().querySphere(center, radius, found);
+    findEntities(found, res);
+}
+Entity *Scene::raycast(const glm::vec3 &origin, const glm::vec3 &dir, float &t)
+{
+    uint32_t i = getTree().raycast(origin, dir, t);
+    return i == BVH::NONE ? nullptr : itemEntities[i];
+}
+PickResult Scene::pick(double x, double y)
+{
+    glm::vec2 ndc(2 * x / width - 1, 1 - 2 * y / height);
+    glm::mat4 inv = glm::inverse(projection * camera.view);
+    glm::vec4 near = inv * glm::vec4(ndc, -1, 1), far = inv * glm::vec4(ndc, 1, 1);
+    glm::vec3 origin = glm::vec3(near) / near.w;
+    return pick(origin, glm::normalize(glm::vec3(far) / far.w - origin));
+}
+PickResult Scene::pick(const glm::vec3 &origin, const glm::vec3 &dir)
+{
+    const BVH &bvh = getTree();
+    const TransformSystem &transforms = getTransforms();
+    PickResult res;
+    float t = INFINITY;
+    bvh.raycast(origin, dir, t, [&](uint32_t i, float &best) {
+        Entity *e = itemEntities[i];
+        const TriangleTree *triangles = e->mesh ? e->mesh->getTriangleTree() : nullptr;
+        if(triangles == nullptr)
+            return false;
+        // an affine map keeps the distances along the ray in lengths of the direction
+        glm::mat4 inv = glm::inverse(transforms.world[transforms.index(e->transformID)]);
+        glm::vec3 o = glm::vec3(inv * glm::vec4(origin, 1)), d = glm::vec3(inv * glm::vec4(dir, 0));
+        if(!triangles->raycast(o, d, best, res.triangle, res.barycentric))
+            return false;
+        res.entity = e;
+        return true;
+    });
+    if(res.entity)
+    {
+        res.distance = t;
+        res.point = origin + t * dir;
+    }
+    return res;
+}
+void Scene::queryRadius(const glm::vec3 &center, float radius, std::vector<Entity*> &res)
+{
+    found.clear();
+    getGrid().queryRadius(center, radius, found);
+    findEntities(found, res);
+}
+void Scene::queryNearest(const glm::vec3 &point, size_t k, std::vector<Entity*> &res)
+{
+    getGrid().nearest(point, k, found);
+    findEntities(found, res);
+}
+void Scene::findPairs(std::vector<std::pair<Entity*, Entity*>> &res)
+{
+    getGrid().pairs(foundPairs);
+    res.clear();
+    for(const auto &p: foundPairs)
+        res.push_back(std::make_pair(itemEntities[p.first], itemEntities[p.second]));
+}
+float Scene::updateBatch(InstanceBatch &b, const uint8_t *vis)
+{
+    const TransformSystem &transforms = getTransforms();
+    b.count = 0;
+    size_t n = std::count(vis, vis + b.entities.size(), 1);
+    if(n == 0)
+        return INFINITY;
+    InstanceData *data = static_cast<InstanceData*>(stream.allocate(n * sizeof(InstanceData), b.offset));
+    if(data == nullptr)  // the stream could not be mapped, nothing to draw
+        return INFINITY;
+    float depth = INFINITY;
+    for(int i=0, l=b.entities.size(); i<l; ++i)
+    {
+        if(!vis[i])
+            continue;
+        Entity *e = b.entities[i];
+        InstanceData &d = data[b.count++];  // mapped memory, which is only written, in order
+        uint32_t t = transforms.index(e->transformID);
+        const glm::mat4 &model = transforms.world[t];
+        d.M = model;
+        if(b.normals)
+            d.N = transforms.normal[t];
+        d.emission = e->material.emission;
+        depth = std::min(depth, -(frameData.V * model[3]).z);
+    }
+    return depth;
+}
+void Scene::drawBatch(InstanceBatch &b)
+{
+    const Material &m = b.entities[0]->material;
+    useProgram(b.material.progID);
+    bindTexture(GL_TEXTURE_2D, m.texture == nullptr ? 0 : m.tID);
+    if(m.lightsEnabled)
+    {
+        glUniform4fv(b.material.aID, 1, &m.ambient[0]);
+        glUniform4fv(b.material.dID, 1, &m.diffuse[0]);
+        glUniform4fv(b.material.sID, 1, &m.specular[0]);
+        glUniform1f(b.material.gID, m.shininess);
+    }
+    bindVertexArray(b.VAO);
+    bindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    for(int i=0; i<8; ++i)  // 4 columns of M, 3 of N and the emission; the offset changes every frame
+    {
+        size_t offset = b.offset + (i<4 ? offsetof(InstanceData, M) + i * sizeof(glm::vec4) :
+                                    i<7 ? offsetof(InstanceData, N) + (i-4) * sizeof(glm::vec3) :
+                                    offsetof(InstanceData, emission));
+        glVertexAttribPointer(AGL_INSTANCE_ATTRIB + i, i<4 || i==7 ? 4 : 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void*)offset);
+    }
+    glDrawElementsInstanced(GL_TRIANGLES, b.mesh->indexCount, GL_UNSIGNED_INT, 0, b.count);
+}
+void Scene::pickAsync(double x, double y, std::function<void(Entity*)> done)
+{
+    PickRequest p;
+    p.cursor = glm::dvec2(x, y);
+    p.done = std::move(done);
+    picks.push_back(std::move(p));
+}
+void Scene::drawPicks()
+{
+    if(std::all_of(picks.begin(), picks.end(), [](const PickRequest &p) { return p.drawn; }))
+        return;
+    const TransformSystem &transforms = getTransforms();
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);  // a state query, it does not wait for the GPU
+    for(PickRequest &p: picks)
+    {
+        if(p.drawn)
+            continue;
+        // a projection whose clip space is the pixel under the cursor; the window coordinates go from the top left
+        glm::mat4 VP = glm::pickMatrix(glm::vec2(p.cursor.x, height - p.cursor.y), glm::vec2(1),
+                                       glm::vec4(0, 0, width, height)) * frameData.VP;
+        Frustum frustum(VP);
+        ids.begin();
+        for(size_t i=0; i<singles.size(); ++i)
+        {
+            if(!visible[i] || !frustum.intersects(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.r[i]))
+                continue;
+            Entity *e = singles[i];
+            p.entities.push_back(e);
+            ids.setSingle(VP, transforms.world[transforms.index(e->transformID)], p.entities.size());
+            const Mesh &m = e->getMesh();
+            bindVertexArray(m.VAO);
+            glDrawElements(GL_TRIANGLES, m.indexCount, GL_UNSIGNED_INT, 0);
+        }
+        for(size_t i=0, first=singles.size(); i<batches.size(); first+=batches[i].entities.size(), ++i)
+        {
+            InstanceBatch &b = batches[i];
+            if(b.count == 0)
+                continue;
+            ids.setInstanced(VP, p.entities.size() + 1);
+            for(size_t k=0; k<b.entities.size(); ++k)  // in the order of the InstanceData, see updateBatch
+                if(visible[first + k])
+                    p.entities.push_back(b.entities[k]);
+            bindVertexArray(b.VAO);  // the instance attributes still point at this frame's data, see drawBatch
+            glDrawElementsInstanced(GL_TRIANGLES, b.mesh->indexCount, GL_UNSIGNED_INT, 0, b.count);
+        }
+        p.slot = ids.end();
+        p.drawn = true;
+    }
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+void Scene::collectPicks()
+{
+    for(size_t i=0; i<picks.size(); )
+    {
+        uint32_t id;
+        if(!picks[i].drawn || !ids.poll(picks[i].slot, id))
+        {
+            ++i;
+            continue;
+        }
+        Entity *e = id == 0 || id > picks[i].entities.size() ? nullptr : picks[i].entities[id - 1];
+        std::function<void(Entity*)> done = std::move(picks[i].done);
+        picks.erase(picks.begin() + i);
+        done(e);  // may request another pick
+    }
+}
 bool Scene::render2D()
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(entities[0]->material.progID);
-    glBindTexture(GL_TEXTURE_2D, entities[0]->material.tID);
+    updateFrame();
+    useProgram(canvas.material.progID);
+    bindTexture(GL_TEXTURE_2D, canvas.material.tID);
+    bindVertexArray(canvas.getMesh().VAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
     glfwSwapBuffers(window);
     glfwPollEvents();
+    endGLStateFrame();
     return glfwWindowShouldClose(window) == 0;
 }
 void Scene::setCamera(const glm::vec3 &pos, const glm::vec3 &lookAt, const glm::vec3 &up)
@@ -225,20 +1013,74 @@ int Scene::setupGL(const char *name)
     }
     glfwMakeContextCurrent(window);
     glfwSetWindowUserPointer(window, this);
+    invalidateGLState();  // a new context
+    activeTexture(GL_TEXTURE0);
+    const char *parallel[][2] = {{"GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR"},
+                                 {"GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB"}};
+    for(const auto &ext: parallel)
+        if(glfwExtensionSupported(ext[0]))
+        {
+            typedef void (*MaxThreadsFn)(GLuint);
+            if(MaxThreadsFn maxThreads = (MaxThreadsFn)glfwGetProcAddress(ext[1]))
+                maxThreads(0xFFFFFFFF);  // let the driver pick the number of threads
+            setParallelShaderCompile(true);
+            break;
+        }
+    const char *storage[][2] = {{"GL_ARB_buffer_storage", "glBufferStorage"},
+                                {"GL_EXT_buffer_storage", "glBufferStorageEXT"}};
+    setBufferStorage(nullptr);
+    for(const auto &ext: storage)
+        if(glfwExtensionSupported(ext[0]))
+            if(BufferStorageFn fn = (BufferStorageFn)glfwGetProcAddress(ext[1]))
+            {
+                setBufferStorage(fn);  // stream through persistently mapped buffers
+                break;
+            }
     return 0;
 }
-void Scene::getAllEntity(std::vector<BaseEntity*> &children)
+void Scene::updateFrame()
 {
-    for(BaseEntity *e: children)
-        if(Light *lght = dynamic_cast<Light*>(e))
-            lights.push_back(lght);
-        else
-        {
-            Entity *ent = dynamic_cast<Entity*>(e);
-            entities.push_back(ent);
-            if(ent->children.size() > 0)
-               getAllEntity(ent->children);
-        }
+    if(frameUBO == 0)
+    {
+        glGenBuffers(1, &frameUBO);
+        bindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), nullptr, GL_DYNAMIC_DRAW);
+        bindBufferBase(GL_UNIFORM_BUFFER, AGL_FRAME_BINDING, frameUBO);
+    }
+    double time = glfwGetTime();
+    int w, h;
+    glfwGetFramebufferSize(window, &w, &h);
+    frameData.VP = getMatVP();
+    frameData.V = camera.view;
+    frameData.P = projection;
+    frameData.vpos = camera._pos;
+    frameData.time = time;
+    frameData.resolution = glm::vec2(w, h);
+    frameData.deltaTime = lastTime < 0 ? 0 : time - lastTime;
+    lastTime = time;
+    bindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &frameData);
+}
+void Scene::updateLights()
+{
+    if(lightData.empty())
+        return;
+    for(int i=0, l=lightData.size(); i<l; ++i)
+    {
+        LightBlock &b = lightData[i];
+        b.ambient = lights[i]->ambient;
+        b.diffuse = lights[i]->diffuse;
+        b.specular = lights[i]->specular;
+        b.position = lights[i]->getPos();
+        b.spotDirection = lights[i]->spotDirection;
+        b.spotExponent = lights[i]->spotExponent;
+        b.spotCosCutoff = lights[i]->spotCosCutoff;
+        b.constantAttenuation = lights[i]->constantAttenuation;
+        b.linearAttenuation = lights[i]->linearAttenuation;
+        b.quadraticAttenuation = lights[i]->quadraticAttenuation;
+    }
+    bindBuffer(GL_UNIFORM_BUFFER, lightsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, lightData.size() * sizeof(LightBlock), &lightData[0]);
 }
 
 Camera::Camera(const glm::vec3 &pos, const glm::vec3 &lookAt, const glm::vec3 &up)
@@ -2,7 +2,18 @@
 #define SCENE_H
 
 #include "entity.h"
+#include "bounds.h"
+#include "bvh.h"
+#include "spatial_grid.h"
+#include "render_queue.h"
+#include "registry.h"
+#include "pick_buffer.h"
+#include "ring_buffer.h"
+#include "slot_map.h"
 #include<vector>
+#include<array>
+#include<tuple>
+#include<functional>
 #include<GLFW/glfw3.h>
 #include "glm/glm.hpp"
 #include "glm/gtc/quaternion.hpp"
@@ -182,6 +193,130 @@ public:
 };
 
 
+/*!
+ * \brief Per-frame constants as laid out in the [std140](https://www.khronos.org/opengl/wiki/Interface_Block_(GLSL)#Memory_layout)
+ * \c Frame uniform block.
+ *
+ * Scene fills this once per frame and uploads it to the uniform buffer bound at #AGL_FRAME_BINDING. Both the generated
+ * shaders and the canvas shaders read the matrices, camera position, time and resolution from there, so the only
+ * per-draw uniforms are the ones of the Entity itself. In GLSL the block is
+ * \code{.glsl}
+ * layout(std140) uniform Frame {
+ *     mat4 VP, V, P;
+ *     vec3 vpos;
+ *     float time;
+ *     vec2 resolution;
+ *     float deltaTime;
+ * };
+ * \endcode
+ */
+struct FrameBlock
+{
+    glm::mat4 VP,  //!< View-projection matrix.
+              V,  //!< View matrix.
+              P;  //!< Projection matrix.
+    glm::vec3 vpos;  //!< Position of the camera.
+    float time;  //!< Time since GLFW was initialized, in seconds.
+    glm::vec2 resolution;  //!< Size of the framebuffer, in pixels.
+    float deltaTime,  //!< Time since the last frame, in seconds.
+          _pad;
+};
+static_assert(sizeof(FrameBlock) == 224, "FrameBlock must match the std140 layout of Frame");
+
+/*!
+ * \brief Per-instance data of an InstanceBatch, read by the instanced shaders from the vertex attributes starting at
+ * #AGL_INSTANCE_ATTRIB.
+ */
+struct InstanceData
+{
+    glm::mat4 M;  //!< Model matrix.
+    glm::mat3 N;  //!< Normal matrix.
+    glm::vec4 emission;  //!< Emission color of the instance.
+};
+
+/*!
+ * \brief What the entities of an InstanceBatch share: mesh, hash of the generated shaders, texture and the colors
+ * except emission.
+ */
+typedef std::tuple<const Mesh*, uint64_t, GLuint, std::array<float, 13>> BatchKey;
+
+/*!
+ * \brief Entities drawn together with a single instanced draw call.
+ *
+ * Scene#prepare groups the entities that share a Mesh (see Entity#mesh) and an equivalent material, ie. the
+ * same generated shader, texture and colors. Only the emission may differ between the entities. Each group of at least
+ * #AGL_INSTANCE_MIN entities gets an instanced program and a vertex array with the per-instance InstanceData, which
+ * is written every frame into the Scene's stream RingBuffer. The material of the batch is read from its first Entity.
+ * Entities added after Scene#prepare with the same #key join the batch.
+ */
+struct InstanceBatch
+{
+    BatchKey key;  //!< What the entities share.
+    std::shared_ptr<Mesh> mesh;  //!< The Mesh whose buffers are drawn, kept alive even if the entities edit theirs.
+    std::vector<Entity*> entities;  //!< The entities in the batch.
+    Material material;  //!< Copy of the first entity's material with the instanced program.
+    GLuint VAO = 0;  //!< Vertex array with the mesh and the instance attributes.
+    bool normals = false;  //!< Does the instanced program read InstanceData#N?
+    size_t offset = 0;  //!< Offset of the InstanceData of this frame in the stream, if #count is not 0.
+    GLsizei count = 0;  //!< Number of InstanceData written this frame, ie. of visible entities.
+};
+
+/*!
+ * \brief A pick on the GPU waiting for its answer, see Scene#pickAsync.
+ */
+struct PickRequest
+{
+    glm::dvec2 cursor;  //!< The point, in window coordinates from the top left.
+    std::function<void(Entity*)> done;  //!< Gets the answer.
+    bool drawn = false;  //!< Were the IDs drawn? The answer is then read back into #slot.
+    size_t slot = 0;  //!< Slot of the PickBuffer the ID is read back into.
+    std::vector<Entity*> entities;  //!< The Entity of each ID drawn, the ID 1 first; removed ones are \c nullptr.
+};
+
+/*!
+ * \brief Memory used by a Scene, see Scene#getMemoryReport.
+ */
+struct MemoryReport
+{
+    /*!
+     * \brief Memory used by the geometry of an Entity.
+     */
+    struct EntityUsage
+    {
+        Entity *entity = nullptr;  //!< The Entity.
+        MemoryUsage mesh;  //!< Memory of its Mesh, in full even if the mesh is shared.
+        uint32_t sharing = 0;  //!< Number of entities of the scene using the same Mesh, including this one.
+    };
+
+    std::vector<EntityUsage> entities;  //!< Each of the Scene#entities.
+    std::vector<std::pair<GLuint, MemoryUsage>> textures,  //!< Each texture ID; the CPU part is Material#texture.
+                                                programs;  //!< Each program ID; the GPU part is the size of its binary.
+    MemoryUsage instances,  //!< The stream of the per-instance data of the batches and the dynamic edits.
+                total;  //!< Everything, with each mesh, texture and program counted once.
+};
+
+/*!
+ * \brief What the last Scene#render drew, see Scene#stats.
+ */
+struct RenderStats
+{
+    uint32_t drawn = 0,  //!< Entity drawn, each instance counted.
+             culled = 0,  //!< Entity skipped because they were outside the view frustum.
+             drawCalls = 0;  //!< Draw calls issued, one per single Entity or visible InstanceBatch.
+};
+
+/*!
+ * \brief What Scene#pick hit.
+ */
+struct PickResult
+{
+    Entity *entity = nullptr;  //!< The Entity hit, or \c nullptr if nothing was.
+    uint32_t triangle = 0;  //!< Triangle hit, ie. its position in the triplets of Mesh#indices.
+    glm::vec2 barycentric;  //!< Weights of the second and third vertices of the triangle at the hit.
+    float distance = INFINITY;  //!< Distance along the ray to the hit, in lengths of its direction.
+    glm::vec3 point;  //!< The hit, in world space.
+};
+
 /*!
  * \brief Scene class, which holds everything.
  *
@@ -196,10 +331,17 @@ public:
         height;  //!< Height of the window.
     glm::mat4 projection;  //!< Projection matrix for the render.
     Camera camera;  //!< Camera for the scene.
-    std::vector<BaseEntity*> children;  //!< Stores all the Entity and Light.
+    std::vector<BaseEntity*> children;  //!< The Entity and Light passed to #add; the #spawned ones are not here.
     GLFWwindow* window;  //!< The GLFW window for displaying everything.
-    std::vector<Entity*> entities;  //!< Temporary store all the Entity before #render.
-    std::vector<Light*> lights;  //!< Temporary store all the Light before #render.
+    Registry registry;  //!< All the Entity and Light in the #children trees.
+    std::vector<Entity*> entities;  //!< The Entity the scene was prepared for, copied from the #registry by #prepare.
+    std::vector<Light*> lights;  //!< The Light the shaders were prepared for, copied from the #registry by #prepare.
+    SlotMap<Entity> spawned;  //!< The Entity owned by the scene, see #spawn.
+    Mesh::Retention retention = Mesh::KEEP_ALL;  //!< What the static Entity keep on the CPU, see Entity#retention.
+    bool culling = true;  //!< Skip the Entity outside the view frustum, see #render.
+    bool useGrid = false;  //!< Rebuild a SpatialGrid every frame instead of refitting the BVH, see #queryRadius.
+    float gridCellSize = 0;  //!< Size of the cells of the grid, 0 to pick it, see SpatialGrid#build.
+    RenderStats stats;  //!< Counts of the last #render.
 
     /*!
      * \brief Create a scene.
@@ -243,11 +385,11 @@ public:
      * This method removes all materials from a scene, resets the matrices with #resetViewProjection, and adds a plane
      * to the scene. The plane spans between -1 to +1 on x and y axis. You can use the vertex positions for the texture
      * coordinates. This is intended for experimentation with fragment shaders. You can set a single texture on the
-     * plane to use in your shader.
+     * plane to use in your shader. The returned Entity is owned by the scene; set its shader with Material#setShader.
      *
      * \sa render2D
      */
-    Entity enableCanvas();
+    Entity &enableCanvas();
     /*!
      * \brief Set a new #camera for the scene.
      * \param pos The position of the camera.
@@ -293,23 +435,170 @@ public:
     /*!
      * \brief Add an Entity or Light to the scene.
      * \param e Entity or Light to add.
+     *
+     * The object and all its children are registered in the #registry. Children added to it later are registered too.
+     * After #prepare, the new Entity get their buffers and shaders on the next #render; see #prepare.
      */
     void add(BaseEntity &e);
+    /*!
+     * \brief Remove an Entity or Light, with all its children, from the scene.
+     * \param e Entity or Light to remove. It is detached from its parent, if any.
+     *
+     * After #prepare, the removed Entity stop being drawn right away. Removing a Light rebuilds the shaders that depend
+     * on the number of lights on the next #render.
+     */
+    void remove(BaseEntity &e);
+    /*!
+     * \brief Add a copy of an Entity, owned by the scene.
+     * \param e The Entity to copy. Its children are not copied.
+     * \return A handle to the copy, see #get.
+     *
+     * Unlike the objects passed to #add, the copy lives in #spawned, so its address stays valid until #despawn or the
+     * end of the scene, and a stale handle is detected instead of dangling. The copy is not in the #children, and each
+     * Entity knows its place in the lists of the scene, so spawning and despawning take constant time, except for
+     * detaching a despawned Entity from a parent it was given, which is linear in its siblings. The draws are updated
+     * by the next #render, once for all the changes of the frame.
+     */
+    Handle spawn(const Entity &e);
+    /*!
+     * \brief Get a spawned Entity.
+     * \return The Entity, or \c nullptr if it was despawned.
+     */
+    Entity *get(Handle h) const;
+    /*!
+     * \brief Remove and destroy a spawned Entity.
+     * \return \c false if the handle was already stale.
+     *
+     * The children of the Entity are removed from the scene too, but not destroyed.
+     */
+    bool despawn(Handle h);
     /*!
      * \brief Enable lighting calculations.
      * \param enable Enable?
      *
-     * This enables (or disables) lights for the scene. This just sets the Material#lightsEnabled for all the Entity.
+     * This enables (or disables) lights for the scene. This just sets the Material#lightsEnabled for all the Entity in
+     * the #registry.
      * The shader for the Entity actually decides if lights should be used or not.
      */
     void enableLights(bool enable=true);
     /*!
      * \brief Prepare the scene before rendering.
+     * \param progress Optional callback, called with the number of programs ready and the total number of programs
+     * while the shaders are compiling, once per check of the programs. It is expected to render and swap a loading
+     * frame, which paces the checks; the scene only yields the thread between them.
+     *
+     * This method takes all the Entity and Light from the #registry and creates the buffers and shaders for the Entity.
+     * All the shaders are submitted before any of them is checked, so the driver can compile them in parallel when
+     * \c GL_KHR_parallel_shader_compile is available. Call this method once before the rendering loop.
+     *
+     * Afterwards the scene keeps itself up to date: the Entity added with #add (or as children of registered entities)
+     * get their buffers and programs at the start of the next #render, joining an existing InstanceBatch when they
+     * match its BatchKey, and removed ones are dropped from the draws at once. When the number of lights changes, only
+     * the generated shaders with Material#lightsEnabled are rebuilt. New entities are not grouped with the ones
+     * already drawn on their own, that needs another call to this method.
+     *
+     * Once uploaded, the meshes of the Entity that are not Entity#dynamic are released down to their Entity#retention
+     * or the scene's #retention, see Mesh#release.
+     */
+    void prepare(std::function<void(int, int)> progress=nullptr);
+    /*!
+     * \brief Find the drawn Entity whose bounds may be visible in a frustum.
+     * \param f The frustum, eg. \c Frustum(getMatVP()).
+     * \param res Gets the entities.
      *
-     * This method scans the Entity tree to access all the Entity and Light and creates the buffers and shaders for the
-     * Entity. Call this method only once before any rendering loop.
+     * The scene keeps a BVH over the world space boxes around the Mesh bounding spheres of all the drawn Entity. It is
+     * refitted by every #render, and built again when the entities change or the tree degrades, so the queries take
+     * logarithmic time for the bounds of the last #render; if entities were added or removed since, the tree is
+     * updated first.
+     */
+    void query(const Frustum &f, std::vector<Entity*> &res);
+    /*!
+     * \brief Find the drawn Entity whose bounds overlap a box, see #query.
+     * \param boxMin Minimum of the box, in world space.
+     * \param boxMax Maximum of the box, in world space.
+     * \param res Gets the entities.
+     */
+    void query(const glm::vec3 &boxMin, const glm::vec3 &boxMax, std::vector<Entity*> &res);
+    /*!
+     * \brief Find the drawn Entity whose bounds overlap a sphere, see #query.
+     * \param center Center of the sphere, in world space.
+     * \param radius Radius of the sphere.
+     * \param res Gets the entities.
+     */
+    void querySphere(const glm::vec3 &center, float radius, std::vector<Entity*> &res);
+    /*!
+     * \brief Find the drawn Entity whose bounds a ray hits first, see #query.
+     * \param origin Origin of the ray, in world space.
+     * \param dir Direction of the ray.
+     * \param t Maximum distance along the ray, in lengths of \a dir; gets the distance to the bounds hit.
+     * \return The Entity, or \c nullptr.
      */
-    void prepare();
+    Entity *raycast(const glm::vec3 &origin, const glm::vec3 &dir, float &t);
+    /*!
+     * \brief Find the triangle of a drawn Entity under a point of the window.
+     * \param x Horizontal position from the left of the window, eg. from \c glfwGetCursorPos.
+     * \param y Vertical position from the top of the window.
+     * \return The hit, nearest to the camera.
+     *
+     * The point is unprojected through #projection and the Camera#view into a ray, see the other overload.
+     */
+    PickResult pick(double x, double y);
+    /*!
+     * \brief Find the triangle of a drawn Entity that a ray hits first.
+     * \param origin Origin of the ray, in world space.
+     * \param dir Direction of the ray.
+     * \return The hit.
+     *
+     * The BVH of #raycast finds the entities whose bounds the ray hits, nearest first. The ray is moved into the model
+     * space of each of them and tested against Mesh#getTriangleTree, with SSE four triangles at a time, and the
+     * entities further than the nearest hit are skipped. The tree of a Mesh is built on its first pick, so the Mesh
+     * must have kept its #vertices and #indices until then, see Mesh::KEEP_POSITIONS.
+     */
+    PickResult pick(const glm::vec3 &origin, const glm::vec3 &dir);
+    /*!
+     * \brief Find the drawn Entity under a point of the window on the GPU, without waiting for the answer.
+     * \param x Horizontal position from the left of the window, eg. from \c glfwGetCursorPos.
+     * \param y Vertical position from the top of the window.
+     * \param done Gets the Entity, or \c nullptr if there is none; it is called by a later #render, usually one or
+     * two frames later.
+     *
+     * The next #render draws the IDs of the visible entities around the point into a PickBuffer, after the frame, and
+     * reads the pixel back without stalling. Unlike #pick, this needs no CPU copy of the geometry and sees the
+     * vertices as the GPU draws them, which suits huge or dynamic meshes, at the cost of the delay. An Entity removed
+     * in the meantime is not returned.
+     */
+    void pickAsync(double x, double y, std::function<void(Entity*)> done);
+    /*!
+     * \brief Find the drawn Entity whose center is within a distance of a point.
+     * \param center The point, in world space.
+     * \param radius The distance.
+     * \param res Gets the entities.
+     *
+     * These queries use a SpatialGrid over the world space centers and radii of the Mesh bounding spheres, ie. the
+     * positions of the entities for meshes centered on their origin. With #useGrid it is rebuilt by every #render and
+     * the BVH of #query is only updated when it is queried; this suits many small entities that all move every frame,
+     * eg. particles. Otherwise the grid is built when it is first queried after a #render.
+     */
+    void queryRadius(const glm::vec3 &center, float radius, std::vector<Entity*> &res);
+    /*!
+     * \brief Find the drawn Entity nearest to a point, see #queryRadius.
+     * \param point The point, in world space.
+     * \param k Number of entities to find.
+     * \param res Gets at most \a k entities, nearest first.
+     */
+    void queryNearest(const glm::vec3 &point, size_t k, std::vector<Entity*> &res);
+    /*!
+     * \brief Find the pairs of drawn Entity whose bounding spheres overlap, see #queryRadius.
+     * \param res Gets the pairs, each once.
+     *
+     * This is the broad phase of a collision detection; the pairs found can then be tested exactly.
+     */
+    void findPairs(std::vector<std::pair<Entity*, Entity*>> &res);
+    /*!
+     * \brief Get the memory used by the prepared scene.
+     * \return CPU and GPU bytes per Entity, texture and program, and in total.
+     */
+    MemoryReport getMemoryReport() const;
     /*!
      * \brief Render the scene.
      * \return Returns \c false, if the #window should close, \c true otherwise.
@@ -317,6 +606,16 @@ public:
      * This method actually renders everything on the window. This loads the required buffers and shaders, sets the
      * parameters, etc. This method must be called each time in the rendering loop to update the scene, say for
      * animations. The return value of this method can be used as the condition for the render loop.
+     *
+     * The draws are queued with a sort key (see #makeSortKey) and sorted every frame, so that the opaque draws sharing
+     * a program, texture and vertex array are issued together, front-to-back. The Material#transparent entities are
+     * drawn last, back-to-front, with blending on and depth writes off. The binds go through the GL state cache, so
+     * the ones that change nothing are skipped; see getGLStateStats for the counts.
+     *
+     * With #culling, the Entity whose Mesh bounding sphere is outside the view frustum of #getMatVP are not queued,
+     * and the instanced batches only draw their visible entities. The frustum is tested against the BVH of the world
+     * bounds first, see #query; only the entities in the leaves crossing its planes are tested one by one. With
+     * #useGrid they are all tested one by one instead, see #queryRadius. The counts end up in #stats.
      */
     bool render();
     /*!
@@ -324,7 +623,7 @@ public:
      * \return Returns \c false, if the #window should close, \c true otherwise.
      *
      * This is an utility method for fast 2D rendering. This is intended to be used with #enableCanvas for running the
-     * shaders. This also sends the resolution and time to the shader.
+     * shaders. This also sends the resolution and time to the shader through the \c Frame block (see FrameBlock).
      *
      * \sa enableCanvas render
      */
@@ -337,6 +636,39 @@ public:
 
 private:
     glm::vec4 bgcolor;  //!< Background color for the scene.
+    Entity canvas;  //!< The plane drawn by #render2D, see #enableCanvas.
+    GLuint lightsUBO = 0,  //!< Uniform buffer for the \c Lights block, bound at #AGL_LIGHTS_BINDING.
+           frameUBO = 0;  //!< Uniform buffer for the \c Frame block, bound at #AGL_FRAME_BINDING.
+    FrameBlock frameData;  //!< CPU side copy of #frameUBO, refilled every frame.
+    double lastTime = -1;  //!< Time of the last frame, for FrameBlock#deltaTime.
+    std::vector<LightBlock> lightData;  //!< CPU side copy of #lightsUBO, refilled every frame.
+    size_t lightSlots = 0;  //!< Number of LightBlock #lightsUBO holds, see #resizeLights.
+    std::vector<Entity*> singles;  //!< The #entities drawn one at a time.
+    std::vector<InstanceBatch> batches;  //!< The #entities drawn instanced.
+    std::vector<uint64_t> drawStates;  //!< Packed state of the #singles followed by the #batches, see #packDrawState.
+    bool drawStatesStale = false;  //!< Were draws removed since the #drawStates were filled?
+    RenderQueue queue;  //!< The draws of the current frame.
+    RingBuffer stream;  //!< Per-frame data: the InstanceData of the #batches and the edits of the Entity#dynamic.
+    BoundingSpheres spheres;  //!< World space spheres of the #singles, then of the entities of each of the #batches.
+    std::vector<Entity*> itemEntities;  //!< The Entity of each of the #spheres, ie. the items of the #tree and #grid.
+    std::vector<glm::vec3> worldMin,  //!< Minimum of the box around each of the #spheres.
+                           worldMax;  //!< Maximum of the box around each of the #spheres.
+    BVH tree;  //!< Hierarchy over the boxes of the #spheres.
+    SpatialGrid grid;  //!< Grid over the #spheres, see #useGrid.
+    bool boundsStale = true,  //!< Did the drawn entities change since the #spheres were filled?
+         treeStale = true,  //!< Did the #spheres change since the #tree was refitted?
+         gridStale = true;  //!< Did the #spheres change since the #grid was built?
+    std::vector<uint32_t> found,  //!< Items found by the last query of the #tree.
+                          partial;  //!< Items of the #tree on the border of the frustum, see #cull.
+    std::vector<std::pair<uint32_t, uint32_t>> foundPairs;  //!< Pairs found by the last SpatialGrid#pairs.
+    BoundingSpheres partialSpheres;  //!< The #spheres of the #partial items.
+    std::vector<uint8_t> visible,  //!< Result of the frustum test for each of the #spheres.
+                         partialVisible;  //!< Result of the frustum test for each of the #partialSpheres.
+    PickBuffer ids;  //!< Target of the ID passes of #pickAsync.
+    std::vector<PickRequest> picks;  //!< The requests of #pickAsync not answered yet.
+    bool prepared = false,  //!< Was #prepare called? Changes to the #registry are then applied incrementally.
+         lightsChanged = false;  //!< Was a Light added or removed since the last #render?
+    std::vector<Entity*> added;  //!< Entity registered since the last #render, waiting for #applyChanges.
 
     /*!
      * \brief Sets up the GLFW window.
@@ -345,12 +677,120 @@ private:
      */
     int setupGL(const char *name);
     /*!
-     * \brief Separates the Entity and Light into #entities and #lights.
-     * \param children The children tree.
+     * \brief Called by the #registry for each object it registers.
+     */
+    void registered(BaseEntity &e);
+    /*!
+     * \brief Called by the #registry for each object it unregisters. Drops an Entity from the draws.
+     */
+    void unregistered(BaseEntity &e);
+    /*!
+     * \brief Create the draws of the #added entities and rebuild the shaders if the lights changed.
+     */
+    void applyChanges();
+    /*!
+     * \brief Resize #lightData to the number of #lights, and grow #lightsUBO to fit them.
+     *
+     * The buffer never shrinks, and always holds at least one light, so that the \c Lights block of every program
+     * still fits: the generated shaders are rebuilt for the new count, but custom ones keep theirs. The slots past the
+     * #lights are filled with dark lights, which add nothing to the shading.
+     */
+    void resizeLights();
+    /*!
+     * \brief Merge the data and create the buffers of some entities, the mesh sources first, then release the meshes.
+     */
+    void createMeshes(const std::vector<Entity*> &list);
+    /*!
+     * \brief Add some entities to the #singles and #batches, and submit their shaders.
+     * \param list The entities.
+     * \param programs Gets the submitted programs.
+     * \param newSingles Gets the entities added to #singles.
+     * \param newBatches Gets the indices of the new #batches.
+     *
+     * An Entity matching the BatchKey of an existing batch joins it. The rest are grouped among themselves.
+     */
+    void createDraws(const std::vector<Entity*> &list, std::vector<GLuint> &programs,
+                     std::vector<Entity*> &newSingles, std::vector<size_t> &newBatches);
+    /*!
+     * \brief Finish the programs submitted by #createDraws or #rebuildLit, and the materials using them.
+     * \param progress See #prepare.
+     */
+    void finishDraws(std::vector<GLuint> &programs, std::function<void(int, int)> progress,
+                     const std::vector<Entity*> &newSingles, const std::vector<size_t> &newBatches);
+    /*!
+     * \brief Submit new shaders for the draws with lights, after the number of #lights changed.
+     */
+    void rebuildLit(std::vector<GLuint> &programs, std::vector<Entity*> &newSingles, std::vector<size_t> &newBatches);
+    /*!
+     * \brief Delete the buffers of all the #batches.
+     */
+    void clearBatches();
+    /*!
+     * \brief Fill #drawStates with the ranks of the programs, textures and vertex arrays.
+     */
+    void createDrawStates();
+    /*!
+     * \brief Draw one of the #singles.
+     * \param e The Entity.
+     */
+    void drawEntity(Entity *e);
+    /*!
+     * \brief Fill the #spheres and the #itemEntities.
+     *
+     * The bounding sphere of the Mesh of the #singles and of the entities of the #batches are moved to world space.
+     */
+    void updateBounds();
+    /*!
+     * \brief The #tree, refitted or built first if it is stale.
+     */
+    const BVH &getTree();
+    /*!
+     * \brief The #grid, built first if it is stale.
+     */
+    const SpatialGrid &getGrid();
+    /*!
+     * \brief Get the #itemEntities of some items of the #tree or #grid.
+     */
+    void findEntities(const std::vector<uint32_t> &items, std::vector<Entity*> &res) const;
+    /*!
+     * \brief Test the #singles and the entities of the #batches against the view frustum.
+     *
+     * The #tree is queried with the frustum first. The items of the leaves crossing its planes are then tested by their
+     * #spheres, four at a time, see Frustum#cull. With #useGrid all the #spheres are tested that way. The result is
+     * left in #visible and counted in #stats.
+     */
+    void cull();
+    /*!
+     * \brief Write the instance data of the visible entities of a batch into the #stream.
+     * \param b The batch.
+     * \param vis The #visible flags of its entities.
+     * \return Distance to the nearest instance, for the sort key.
+     */
+    float updateBatch(InstanceBatch &b, const uint8_t *vis);
+    /*!
+     * \brief Draw one of the #batches.
+     * \param b The batch.
+     */
+    void drawBatch(InstanceBatch &b);
+    /*!
+     * \brief Draw the IDs for the #picks requested since the last #render, after the frame.
+     */
+    void drawPicks();
+    /*!
+     * \brief Answer the #picks whose IDs were read back.
+     */
+    void collectPicks();
+    /*!
+     * \brief Fill #frameUBO with the matrices, camera position, time and resolution for this frame.
+     */
+    void updateFrame();
+    /*!
+     * \brief Fill #lightsUBO from #lights.
      *
-     * This method runs a recursive DFS on all the children to separate all the Entity and Light.
+     * This is called once per frame, before any Entity is drawn. All the programs read the lights from the same buffer,
+     * so the cost is independent of the number of entities.
      */
-    void getAllEntity(std::vector<BaseEntity*> &children);
+    void updateLights();
 };
 
 /*!
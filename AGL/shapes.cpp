@@ -13,13 +13,15 @@ Entity tetrahedron()
                  0, 3, 1,
                  1, 3, 2};
     Entity e;
-    e.vertices.assign(verts, verts + 12);
-    e.indices.assign(idx, idx + 12);
+    Mesh &m = e.editMesh();
+    m.vertices.assign(verts, verts + 12);
+    m.indices.assign(idx, idx + 12);
     return e;
 }
 Entity cube(bool calcNorm, bool calcUV)
 {
     Entity e;
+    Mesh &m = e.editMesh();
     int verts[] = {-1,-1,-1,    -1,-1, 1,    -1, 1,-1,    -1, 1, 1,
                     1,-1,-1,     1,-1, 1,     1, 1,-1,     1, 1, 1},
         idx[] = {0, 1, 2,     1, 3, 2,  // left
@@ -33,16 +35,16 @@ Entity cube(bool calcNorm, bool calcUV)
         for(int i=0; i<8; ++i)
             for(int j=0; j<3; ++j)
             {
-                e.vertices.push_back(verts[i*3  ]);
-                e.vertices.push_back(verts[i*3+1]);
-                e.vertices.push_back(verts[i*3+2]);
+                m.vertices.push_back(verts[i*3  ]);
+                m.vertices.push_back(verts[i*3+1]);
+                m.vertices.push_back(verts[i*3+2]);
                 if(calcNorm)
                     for(int k=0; k<3; ++k)
-                        e.normals.push_back(j==k ? verts[i*3+k] : 0);
+                        m.normals.push_back(j==k ? verts[i*3+k] : 0);
             }
         for(int i=0; i<3; ++i)
             for(int j=0; j<12; ++j)
-                e.indices.push_back(idx[i*12+j]*3+i);
+                m.indices.push_back(idx[i*12+j]*3+i);
         if(calcUV)
         {
             int uv[] = {0, 0,     1, 1,     1, 0,     1, 0,
@@ -51,13 +53,13 @@ Entity cube(bool calcNorm, bool calcUV)
                         1, 0,     0, 1,     0, 0,     0, 0,
                         0, 0,     1, 0,     1, 1,     1, 1,
                         0, 1,     0, 1,     1, 0,     1, 1};
-            e.uvs.assign(uv, uv + 48);
+            m.uvs.assign(uv, uv + 48);
         }
     }
     else
     {
-        e.vertices.assign(verts, verts + 24);
-        e.indices.assign(idx, idx + 36);
+        m.vertices.assign(verts, verts + 24);
+        m.indices.assign(idx, idx + 36);
     }
     return e;
 }
@@ -65,11 +67,12 @@ Entity cuboid(float x, float y, float z, bool calcNorm, bool calcUV)
 {
     x /= 2; y /= 2; z /= 2;
     Entity e = cube(calcNorm, calcUV);
+    Mesh &m = e.editMesh();
     for(int i=0; i<72; i+=3)
     {
-        e.vertices[i  ] *= x;
-        e.vertices[i+1] *= y;
-        e.vertices[i+2] *= z;
+        m.vertices[i  ] *= x;
+        m.vertices[i+1] *= y;
+        m.vertices[i+2] *= z;
     }
     return e;
 }
@@ -81,8 +84,9 @@ Entity octahedron()
         idx[] = {0, 4, 2,     1, 2, 4,     2, 5, 0,     1, 5, 2,
                  0, 3, 4,     1, 4, 3,     0, 5, 3,     1, 3, 5};
     Entity e;
-    e.vertices.assign(verts, verts + 18);
-    e.indices.assign(idx, idx + 24);
+    Mesh &m = e.editMesh();
+    m.vertices.assign(verts, verts + 18);
+    m.indices.assign(idx, idx + 24);
     return e;
 }
 Entity dodecahedron()  // TODO: Correctly orrient vertices
@@ -92,41 +96,43 @@ Entity dodecahedron()  // TODO: Correctly orrient vertices
 #define Q 0.618033988749894848204586834365638117720309179805762862135
 //! \endcond
     Entity e;
+    Mesh &m = e.editMesh();
     float verts[] = { 1, 1, 1,     1, 1,-1,     1,-1, 1,     1,-1,-1,
                      -1, 1, 1,    -1, 1,-1,    -1,-1, 1,    -1,-1,-1,
                       0, Q, P,     0, Q,-P,     0,-Q, P,     0,-Q,-P,
                       Q, P, 0,     Q,-P, 0,    -Q, P, 0,    -Q,-P, 0,
                       P, 0, Q,     P, 0,-Q,    -P, 0, Q,    -P, 0,-Q};
-    e.vertices.assign(verts, verts + 60);
+    m.vertices.assign(verts, verts + 60);
     std::vector<GLuint> v = triangulatePolygon(std::vector<GLuint>{ 0,16, 2,10, 8});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 0, 8, 4,14,12});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{16,17, 1,12, 0});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 1, 9,11, 3,17});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 1,12,14, 5, 9});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 2,13,15, 6,10});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{13, 3,17,16, 2});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 3,11, 7,15,13});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 4, 8,10, 6,18});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{14, 5,19,18, 4});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{ 5,19, 7,11, 9});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     v = triangulatePolygon(std::vector<GLuint>{15, 7,19,18, 6});
-    e.indices.insert(e.indices.end(), v.begin(), v.end());
+    m.indices.insert(m.indices.end(), v.begin(), v.end());
     return e;
 }
 Entity icosahedron()
 {
     Entity e;
+    Mesh &m = e.editMesh();
     float verts[] = { 0, P, 1,     0, P,-1,     0,-P, 1,     0,-P,-1,
                       1, 0, P,    -1, 0, P,     1, 0,-P,    -1, 0,-P,
                       P, 1, 0,     P,-1, 0,    -P, 1, 0,    -P,-1, 0};
@@ -134,13 +140,14 @@ Entity icosahedron()
                  1, 6, 7,    1, 8, 6,    1, 7,10,    2, 3, 9,    2, 4, 5,
                  2, 5,11,    2, 9, 4,    2,11, 3,    3, 6, 9,    3, 7, 6,
                  3,11, 7,    4, 9, 8,    5,10,11,    6, 8, 9,    7,11,10};
-    e.vertices.assign(verts, verts + 36);
-    e.indices.assign(idx, idx + 60);
+    m.vertices.assign(verts, verts + 36);
+    m.indices.assign(idx, idx + 60);
     return e;
 }
 Entity sphere(int lat, int lng, bool calcNorm, bool calcUV)
 {
     Entity e;
+    Mesh &m = e.editMesh();
     float xy, x, y, z,
           latStep = 2 * AGL_PI / lat,
           lngInv = 1. / lng,
@@ -155,19 +162,19 @@ Entity sphere(int lat, int lng, bool calcNorm, bool calcUV)
             latAngle = j * latStep;
             x = xy * std::cos(latAngle);
             y = xy * std::sin(latAngle);
-            e.vertices.push_back(x);
-            e.vertices.push_back(y);
-            e.vertices.push_back(z);
+            m.vertices.push_back(x);
+            m.vertices.push_back(y);
+            m.vertices.push_back(z);
             if(calcNorm)
             {
-                e.normals.push_back(x);
-                e.normals.push_back(y);
-                e.normals.push_back(z);
+                m.normals.push_back(x);
+                m.normals.push_back(y);
+                m.normals.push_back(z);
             }
             if(calcUV)
             {
-                e.uvs.push_back(float(j) / lat);
-                e.uvs.push_back(float(i) / lng);
+                m.uvs.push_back(float(j) / lat);
+                m.uvs.push_back(float(i) / lng);
             }
         }
     }
@@ -180,15 +187,15 @@ Entity sphere(int lat, int lng, bool calcNorm, bool calcUV)
         {
             if(i != 0)
             {
-                e.indices.push_back(k1);
-                e.indices.push_back(k2);
-                e.indices.push_back(k1 + 1);
+                m.indices.push_back(k1);
+                m.indices.push_back(k2);
+                m.indices.push_back(k1 + 1);
             }
             if(i != lng - 1)
             {
-                e.indices.push_back(k1 + 1);
-                e.indices.push_back(k2);
-                e.indices.push_back(k2 + 1);
+                m.indices.push_back(k1 + 1);
+                m.indices.push_back(k2);
+                m.indices.push_back(k2 + 1);
             }
         }
     }
@@ -201,12 +208,16 @@ Entity icosphere(int subdivision, bool calcNorm)
         subdivideFaces(e);
     normalizeVertices(e);
     if(calcNorm)
-        e.normals.assign(e.vertices.begin(), e.vertices.end());
+    {
+        Mesh &m = e.editMesh();
+        m.normals.assign(m.vertices.begin(), m.vertices.end());
+    }
     return e;
 }
 Entity cylinder(float r, float h, int strips)  // TODO: Add normals
 {
     Entity e;
+    Mesh &m = e.editMesh();
     float step = 2 * AGL_PI / strips, ang = 0, x, y;
     h /= 2;
     std::vector<GLuint> upper, lower;
@@ -214,53 +225,54 @@ Entity cylinder(float r, float h, int strips)  // TODO: Add normals
     {
         x = std::cos(ang);
         y = std::sin(ang);
-        e.vertices.push_back(x*r);
-        e.vertices.push_back(-h);
-        e.vertices.push_back(y*r);
-        e.vertices.push_back(x*r);
-        e.vertices.push_back(h);
-        e.vertices.push_back(y*r);
+        m.vertices.push_back(x*r);
+        m.vertices.push_back(-h);
+        m.vertices.push_back(y*r);
+        m.vertices.push_back(x*r);
+        m.vertices.push_back(h);
+        m.vertices.push_back(y*r);
         if(i > 0)
         {
-            e.indices.push_back(2*(i-1)  );
-            e.indices.push_back(2* i   +1);
-            e.indices.push_back(2*(i-1)+1);
-            e.indices.push_back(2*(i-1)  );
-            e.indices.push_back(2* i     );
-            e.indices.push_back(2* i   +1);
+            m.indices.push_back(2*(i-1)  );
+            m.indices.push_back(2* i   +1);
+            m.indices.push_back(2*(i-1)+1);
+            m.indices.push_back(2*(i-1)  );
+            m.indices.push_back(2* i     );
+            m.indices.push_back(2* i   +1);
         }
         lower.push_back(2*i  );
         upper.push_back(2*i+1);
     }
-    e.indices.push_back(2*(strips-1)  );
-    e.indices.push_back(             1);
-    e.indices.push_back(2*(strips-1)+1);
-    e.indices.push_back(2*(strips-1)  );
-    e.indices.push_back(             0);
-    e.indices.push_back(             1);
+    m.indices.push_back(2*(strips-1)  );
+    m.indices.push_back(             1);
+    m.indices.push_back(2*(strips-1)+1);
+    m.indices.push_back(2*(strips-1)  );
+    m.indices.push_back(             0);
+    m.indices.push_back(             1);
     lower = triangulatePolygon(lower);
-    e.indices.insert(e.indices.end(), lower.begin(), lower.end());
+    m.indices.insert(m.indices.end(), lower.begin(), lower.end());
     upper = triangulatePolygon(upper);
-    e.indices.insert(e.indices.end(), upper.begin(), upper.end());
+    m.indices.insert(m.indices.end(), upper.begin(), upper.end());
     return e;
 }
 Entity plane(float x, float z, bool calcNorm, bool calcUV)
 {
     x /= 2; z /= 2;
     Entity e;
+    Mesh &m = e.editMesh();
     float verts[] = {-x, 0,-z,    -x, 0, z,     x, 0,-z,     x, 0, z};
     int idx[] = {0, 1, 2,     1, 3, 2};
-    e.vertices.assign(verts, verts + 12);
-    e.indices.assign(idx, idx + 6);
+    m.vertices.assign(verts, verts + 12);
+    m.indices.assign(idx, idx + 6);
     if(calcNorm)
     {
         int norm[] = {0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0};
-        e.normals.assign(norm, norm + 12);
+        m.normals.assign(norm, norm + 12);
     }
     if(calcUV)
     {
         int uv[] = {0, 1, 0, 0, 1, 1, 1, 0};
-        e.uvs.assign(uv, uv + 8);
+        m.uvs.assign(uv, uv + 8);
     }
     return e;
 }
@@ -268,49 +280,52 @@ Entity tessellatedPlane(int l, int h)
 {
     float x = l / 2., z = h / 2.;
     Entity e;
+    Mesh &m = e.editMesh();
     for(float i=-x; i<=x; ++i)
         for(float j=-z; j<=z; ++j)
         {
-            e.vertices.push_back(i);
-            e.vertices.push_back(0);
-            e.vertices.push_back(j);
+            m.vertices.push_back(i);
+            m.vertices.push_back(0);
+            m.vertices.push_back(j);
         }
     for(int i=0; i<l; ++i)
         for(int j=0; j<h; ++j)
         {
-            e.indices.push_back( i    * (h+1) + j  );
-            e.indices.push_back( i    * (h+1) + j+1);
-            e.indices.push_back((i+1) * (h+1) + j  );
-            e.indices.push_back( i    * (h+1) + j+1);
-            e.indices.push_back((i+1) * (h+1) + j+1);
-            e.indices.push_back((i+1) * (h+1) + j  );
+            m.indices.push_back( i    * (h+1) + j  );
+            m.indices.push_back( i    * (h+1) + j+1);
+            m.indices.push_back((i+1) * (h+1) + j  );
+            m.indices.push_back( i    * (h+1) + j+1);
+            m.indices.push_back((i+1) * (h+1) + j+1);
+            m.indices.push_back((i+1) * (h+1) + j  );
         }
     return e;
 }
 
 void normalizeVertices(Entity &e, float t)
 {
+    Mesh &m = e.editMesh();
     float x, y, z, invSum;
-    for(int i=0, l=e.vertices.size()/3; i<l; ++i)
+    for(int i=0, l=m.vertices.size()/3; i<l; ++i)
     {
-        x = e.vertices[i*3  ];
-        y = e.vertices[i*3+1];
-        z = e.vertices[i*3+2];
+        x = m.vertices[i*3  ];
+        y = m.vertices[i*3+1];
+        z = m.vertices[i*3+2];
         invSum = t / std::sqrt(x * x + y * y + z * z);
-        e.vertices[i*3  ] = x * invSum + (1 - t) * e.vertices[i*3  ];
-        e.vertices[i*3+1] = y * invSum + (1 - t) * e.vertices[i*3+1];
-        e.vertices[i*3+2] = z * invSum + (1 - t) * e.vertices[i*3+2];
+        m.vertices[i*3  ] = x * invSum + (1 - t) * m.vertices[i*3  ];
+        m.vertices[i*3+1] = y * invSum + (1 - t) * m.vertices[i*3+1];
+        m.vertices[i*3+2] = z * invSum + (1 - t) * m.vertices[i*3+2];
     }
 }
 void subdivideFaces(Entity &e)
 {
-    int nv = e.vertices.size() / 3, a, b, c;
+    Mesh &m = e.editMesh();
+    int nv = m.vertices.size() / 3, a, b, c;
     std::vector<int> edges(nv*nv, 0);  // TODO: Improve hashing
-    for(int i=0, l=e.indices.size()/3; i<l; ++i)
+    for(int i=0, l=m.indices.size()/3; i<l; ++i)
     {
-        a = e.indices[i*3  ];
-        b = e.indices[i*3+1];
-        c = e.indices[i*3+2];
+        a = m.indices[i*3  ];
+        b = m.indices[i*3+1];
+        c = m.indices[i*3+2];
         edges[a*nv+b] = edges[b*nv+c] = edges[c*nv+a] = 1;
     }
     c = nv;
@@ -319,17 +334,17 @@ void subdivideFaces(Entity &e)
         {
             a = i / nv;
             b = i % nv;
-            e.vertices.push_back((e.vertices[a*3  ] + e.vertices[b*3  ]) / 2);
-            e.vertices.push_back((e.vertices[a*3+1] + e.vertices[b*3+1]) / 2);
-            e.vertices.push_back((e.vertices[a*3+2] + e.vertices[b*3+2]) / 2);
+            m.vertices.push_back((m.vertices[a*3  ] + m.vertices[b*3  ]) / 2);
+            m.vertices.push_back((m.vertices[a*3+1] + m.vertices[b*3+1]) / 2);
+            m.vertices.push_back((m.vertices[a*3+2] + m.vertices[b*3+2]) / 2);
             edges[i] = c++;
         }
     std::vector<GLuint> newIndices;
-    for(int i=0, l=e.indices.size()/3; i<l; ++i)
+    for(int i=0, l=m.indices.size()/3; i<l; ++i)
     {
-        a = e.indices[i*3  ];
-        b = e.indices[i*3+1];
-        c = e.indices[i*3+2];
+        a = m.indices[i*3  ];
+        b = m.indices[i*3+1];
+        c = m.indices[i*3+2];
         newIndices.push_back(a);
         newIndices.push_back(edges[a*nv+b]);
         newIndices.push_back(edges[c*nv+a]);
@@ -343,47 +358,49 @@ void subdivideFaces(Entity &e)
         newIndices.push_back(edges[b*nv+c]);
         newIndices.push_back(edges[c*nv+a]);
     }
-    e.indices.swap(newIndices);
+    m.indices.swap(newIndices);
 }
 void calcNormals(Entity &e, bool perFace)
 {
-    int l = e.vertices.size();
+    Mesh &m = e.editMesh();
+    int l = m.vertices.size();
     float ax = 0, ay = 0, az = 0, x, y, z, invSum;
-    e.normals.clear();
+    m.normals.clear();
     for(int i=0; i<l; i+=3)
     {
-        ax += e.vertices[i  ];
-        ay += e.vertices[i+1];
-        az += e.vertices[i+2];
+        ax += m.vertices[i  ];
+        ay += m.vertices[i+1];
+        az += m.vertices[i+2];
     }
     ax /= l; ay /= l; az /= l;
     for(int i=0; i<l; i+=3)
     {
-        x = e.vertices[i  ] - ax;
-        y = e.vertices[i+1] - ay;
-        z = e.vertices[i+2] - az;
+        x = m.vertices[i  ] - ax;
+        y = m.vertices[i+1] - ay;
+        z = m.vertices[i+2] - az;
         invSum = 1 / std::sqrt(x * x + y * y + z * z);
-        e.normals.push_back(x * invSum);
-        e.normals.push_back(y * invSum);
-        e.normals.push_back(z * invSum);
+        m.normals.push_back(x * invSum);
+        m.normals.push_back(y * invSum);
+        m.normals.push_back(z * invSum);
     }
 }
 void calcTextureCoords(Entity &e, glm::vec3 px, glm::vec3 py, bool normalize)
 {
+    Mesh &m = e.editMesh();
     float x, y, inv;
-    e.uvs.clear();
-    for(int i=0, l=e.vertices.size(); i<l; i+=3)
+    m.uvs.clear();
+    for(int i=0, l=m.vertices.size(); i<l; i+=3)
     {
-        x = e.vertices[i] * px.x + e.vertices[i+1] * px.y + e.vertices[i+2] * px.z;
-        y = e.vertices[i] * py.x + e.vertices[i+1] * py.y + e.vertices[i+2] * py.z;
+        x = m.vertices[i] * px.x + m.vertices[i+1] * px.y + m.vertices[i+2] * px.z;
+        y = m.vertices[i] * py.x + m.vertices[i+1] * py.y + m.vertices[i+2] * py.z;
         if(normalize)
         {
             inv = 1 / std::sqrt(x * x + y * y);
             x *= inv;
             y *= inv;
         }
-        e.uvs.push_back(x);
-        e.uvs.push_back(y);
+        m.uvs.push_back(x);
+        m.uvs.push_back(y);
     }
 }
 std::vector<GLuint> triangulatePolygon(const std::vector<GLuint> &polygon)
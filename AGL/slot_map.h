@@ -0,0 +1,151 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include<vector>
+#include<memory>
+#include<cstdint>
+
+namespace agl {
+/*!
+ * \brief Reference to an object in a SlotMap, which detects when the object is gone.
+ *
+ * A default constructed handle refers to nothing, generations start at 1.
+ */
+struct Handle
+{
+    uint32_t index = 0,  //!< Slot of the object.
+             generation = 0;  //!< Generation of the slot when the object was inserted.
+
+    inline bool operator==(const Handle &other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+    inline bool operator!=(const Handle &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/*!
+ * \brief Owning container with stable handles and O(1) insertion and removal.
+ *
+ * The objects are listed densely in #objects, so iterating over all of them is linear. Each object also has a slot,
+ * which maps its Handle to its dense index. Removing an object moves the last one into its place (swap and pop) and
+ * increments the generation of its slot, so the handles of the removed object stop resolving and the slot can be
+ * reused right away.
+ *
+ * The objects are heap allocated and only their pointers are moved around, so their addresses never change while
+ * they are in the map. This is what lets the registry, the render queue and the parents keep plain pointers to them.
+ */
+template<class T>
+class SlotMap
+{
+public:
+    std::vector<std::unique_ptr<T>> objects;  //!< The objects, densely packed in no particular order.
+
+    /*!
+     * \brief Take ownership of an object.
+     * \return Its handle.
+     */
+    Handle insert(std::unique_ptr<T> obj)
+    {
+        Handle h;
+        if(freeSlots.empty())
+        {
+            h.index = slots.size();
+            slots.push_back(Slot());
+        }
+        else
+        {
+            h.index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        Slot &s = slots[h.index];
+        s.dense = objects.size();
+        h.generation = s.generation;
+        objects.push_back(std::move(obj));
+        owners.push_back(h.index);
+        return h;
+    }
+    /*!
+     * \brief Get the object of a handle.
+     * \return The object, or \c nullptr if it was removed.
+     */
+    inline T *get(Handle h) const
+    {
+        return contains(h) ? objects[slots[h.index].dense].get() : nullptr;
+    }
+    /*!
+     * \brief Does the object of the handle still exist?
+     */
+    inline bool contains(Handle h) const
+    {
+        return h.index < slots.size() && slots[h.index].generation == h.generation;
+    }
+    /*!
+     * \brief Destroy the object of a handle.
+     * \return \c false if it was already removed.
+     */
+    bool remove(Handle h)
+    {
+        if(!contains(h))
+            return false;
+        Slot &s = slots[h.index];
+        uint32_t i = s.dense;
+        std::unique_ptr<T> obj = std::move(objects[i]);
+        objects[i] = std::move(objects.back());  // swap and pop
+        owners[i] = owners.back();
+        slots[owners[i]].dense = i;
+        objects.pop_back();
+        owners.pop_back();
+        ++s.generation;
+        freeSlots.push_back(h.index);
+        obj.reset();  // destroyed last, when the map is consistent again
+        return true;
+    }
+    /*!
+     * \brief Destroy all the objects; their handles become stale.
+     */
+    void clear()
+    {
+        std::vector<std::unique_ptr<T>> old;
+        old.swap(objects);
+        for(uint32_t s: owners)
+        {
+            ++slots[s].generation;
+            freeSlots.push_back(s);
+        }
+        owners.clear();
+        old.clear();  // destroyed last, when the map is consistent again
+    }
+    /*!
+     * \brief Get the handle of the object at a dense index of #objects.
+     */
+    inline Handle handle(uint32_t i) const
+    {
+        Handle h;
+        h.index = owners[i];
+        h.generation = slots[h.index].generation;
+        return h;
+    }
+    /*!
+     * \brief Number of objects.
+     */
+    inline size_t size() const
+    {
+        return objects.size();
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t dense = 0,  //!< Index in #objects.
+                 generation = 1;  //!< Incremented each time the object of the slot is removed.
+    };
+    std::vector<Slot> slots;  //!< Handle#index -> Slot.
+    std::vector<uint32_t> owners;  //!< Slot of each of the #objects.
+    std::vector<uint32_t> freeSlots;  //!< Slots without an object.
+};
+}
+
+#endif // SLOT_MAP_H
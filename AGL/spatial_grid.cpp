@@ -0,0 +1,233 @@
+#include "spatial_grid.h"
+#include "util.h"
+#include<algorithm>
+#include<cmath>
+#include<thread>
+
+namespace agl {
+namespace {
+/*
+ * Run fn(0) to fn(count - 1), each on its own thread except the first, which runs on the caller's.
+ */
+template<class Fn>
+void parallel(uint32_t count, Fn fn)
+{
+    std::vector<std::thread> threads;
+    for(uint32_t i=1; i<count; ++i)
+        threads.emplace_back(fn, i);
+    fn(0);
+    for(std::thread &t: threads)
+        t.join();
+}
+}
+
+glm::ivec3 SpatialGrid::cell(const glm::vec3 &p) const
+{
+    // clamped, far enough to be outside any grid, so that the conversion does not overflow
+    const float limit = 1 << 29;  // the differences of two cells still fit
+    return glm::ivec3(glm::clamp(glm::floor(p / cellSize), glm::vec3(-limit), glm::vec3(limit)));
+}
+uint32_t SpatialGrid::bucket(const glm::ivec3 &c) const
+{
+    // a xor of the products collides a lot for small coordinates of mixed signs, a sum doesn't
+    uint32_t h = uint32_t(c.x) * 0x8DA6B343u + uint32_t(c.y) * 0xD8163841u + uint32_t(c.z) * 0xCB1AB31Fu;
+    h ^= h >> 16;  // mix the high bits into the low ones kept by the mask
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h & (bucketStart.size() - 2);  // the number of buckets is a power of 2
+}
+void SpatialGrid::buckets(const glm::ivec3 &lo, const glm::ivec3 &hi, std::vector<uint32_t> &res) const
+{
+    uint32_t n = bucketStart.size() - 1;
+    glm::ivec3 lo2 = glm::max(lo, cellMin), hi2 = glm::min(hi, cellMax);  // no centers outside
+    if(glm::any(glm::lessThan(hi2, lo2)))
+        return;
+    glm::dvec3 extent = glm::dvec3(hi2 - lo2) + 1.;
+    if(extent.x * extent.y * extent.z >= n)  // as many cells as buckets, take them all
+    {
+        for(uint32_t b=0; b<n; ++b)
+            res.push_back(b);
+        return;
+    }
+    for(int z=lo2.z; z<=hi2.z; ++z)
+        for(int y=lo2.y; y<=hi2.y; ++y)
+            for(int x=lo2.x; x<=hi2.x; ++x)
+                res.push_back(bucket(glm::ivec3(x, y, z)));
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());  // cells colliding in a bucket
+}
+void SpatialGrid::build(const BoundingSpheres &spheres, float size)
+{
+    uint32_t n = spheres.size();
+    glm::vec3 mn(INFINITY), mx(-INFINITY);
+    float maxRadius = 0;
+    for(uint32_t i=0; i<n; ++i)
+    {
+        glm::vec3 p(spheres.x[i], spheres.y[i], spheres.z[i]);
+        mn = glm::min(mn, p);
+        mx = glm::max(mx, p);
+        maxRadius = std::max(maxRadius, spheres.r[i]);
+    }
+    if(size <= 0 && n > 0)  // about one center per cell
+    {
+        glm::vec3 extent = glm::max(mx - mn, glm::vec3(1e-3f));
+        size = std::cbrt(extent.x * extent.y * extent.z / n);
+    }
+    cellSize = std::max(std::max(size, 2 * maxRadius), 1e-6f);
+    cellMin = n == 0 ? glm::ivec3(0) : cell(mn);
+    cellMax = n == 0 ? glm::ivec3(-1) : cell(mx);
+
+    uint32_t buckets = 1;
+    while(buckets < 2 * n)
+        buckets <<= 1;
+    bucketStart.assign(buckets + 1, 0);
+    visited.assign(buckets, 0);
+    search = 0;
+    uint32_t chunks = std::max(1u, std::min(n / AGL_GRID_CHUNK, std::max(1u, std::thread::hardware_concurrency())));
+    uint32_t chunkSize = (n + chunks - 1) / chunks;
+    bucketOf.resize(n);
+    counts.assign(size_t(chunks) * buckets, 0);
+    parallel(chunks, [&](uint32_t c) {  // count the spheres of each bucket, per chunk
+        uint32_t *count = &counts[size_t(c) * buckets];
+        for(uint32_t i=c*chunkSize, end=std::min(n, i+chunkSize); i<end; ++i)
+        {
+            bucketOf[i] = bucket(cell(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i])));
+            ++count[bucketOf[i]];
+        }
+    });
+    uint32_t offset = 0;
+    for(uint32_t b=0; b<buckets; ++b)  // prefix sums, turning the counts into the offsets of each chunk
+    {
+        bucketStart[b] = offset;
+        for(uint32_t c=0; c<chunks; ++c)
+        {
+            uint32_t &count = counts[size_t(c) * buckets + b];
+            uint32_t k = count;
+            count = offset;
+            offset += k;
+        }
+    }
+    bucketStart[buckets] = n;
+    items.resize(n);
+    sorted.x.resize(n);
+    sorted.y.resize(n);
+    sorted.z.resize(n);
+    sorted.r.resize(n);
+    parallel(chunks, [&](uint32_t c) {  // scatter, each chunk to its own slots, so the sort is stable
+        uint32_t *next = &counts[size_t(c) * buckets];
+        for(uint32_t i=c*chunkSize, end=std::min(n, i+chunkSize); i<end; ++i)
+        {
+            uint32_t j = next[bucketOf[i]]++;
+            items[j] = i;
+            sorted.x[j] = spheres.x[i];
+            sorted.y[j] = spheres.y[i];
+            sorted.z[j] = spheres.z[i];
+            sorted.r[j] = spheres.r[i];
+        }
+    });
+}
+void SpatialGrid::queryRadius(const glm::vec3 &center, float radius, std::vector<uint32_t> &res) const
+{
+    if(items.empty())
+        return;
+    std::vector<uint32_t> found;
+    buckets(cell(center - radius), cell(center + radius), found);
+    float r2 = radius * radius;
+    for(uint32_t b: found)
+        for(uint32_t j=bucketStart[b]; j<bucketStart[b+1]; ++j)
+        {
+            float x = sorted.x[j] - center.x, y = sorted.y[j] - center.y, z = sorted.z[j] - center.z;
+            if(x*x + y*y + z*z <= r2)
+                res.push_back(items[j]);
+        }
+}
+void SpatialGrid::nearest(const glm::vec3 &point, size_t k, std::vector<uint32_t> &res) const
+{
+    res.clear();
+    if(items.empty() || k == 0)
+        return;
+    std::vector<std::pair<float, uint32_t>> best;  // max-heap of the nearest so far
+    std::vector<uint32_t> found;
+    if(++search == 0)  // wrapped around, the old marks could match again
+    {
+        std::fill(visited.begin(), visited.end(), 0);
+        search = 1;
+    }
+    uint32_t visits = 0;
+    glm::ivec3 c = cell(point);
+    glm::ivec3 far = glm::max(glm::abs(c - cellMin), glm::abs(cellMax - c));
+    int last = std::max(std::max(far.x, far.y), far.z);  // the ring reaching the furthest cell
+    glm::ivec3 near = glm::max(glm::max(cellMin - c, c - cellMax), glm::ivec3(0));
+    int first = std::max(std::max(near.x, near.y), near.z);  // the rings before the nearest cell are empty
+    for(int ring=first; ring<=last; ++ring)
+    {
+        found.clear();
+        if(ring == 0)
+            buckets(c, c, found);
+        else  // the six faces of the shell, without overlaps
+            for(int axis=0; axis<3; ++axis)
+                for(int side=-1; side<=1; side+=2)
+                {
+                    glm::ivec3 lo = c - ring, hi = c + ring;
+                    lo[axis] = hi[axis] = c[axis] + side * ring;
+                    for(int a=0; a<axis; ++a)  // the edges belong to the faces of the previous axes
+                    {
+                        ++lo[a];
+                        --hi[a];
+                    }
+                    buckets(lo, hi, found);
+                }
+        for(uint32_t b: found)
+        {
+            if(visited[b] == search)
+                continue;
+            visited[b] = search;
+            ++visits;
+            for(uint32_t j=bucketStart[b]; j<bucketStart[b+1]; ++j)
+            {
+                float x = sorted.x[j] - point.x, y = sorted.y[j] - point.y, z = sorted.z[j] - point.z,
+                      d2 = x*x + y*y + z*z;
+                if(best.size() == k && d2 >= best.front().first)
+                    continue;
+                best.push_back(std::make_pair(d2, items[j]));
+                std::push_heap(best.begin(), best.end());
+                if(best.size() > k)
+                {
+                    std::pop_heap(best.begin(), best.end());
+                    best.pop_back();
+                }
+            }
+        }
+        float reach = ring * cellSize;  // anything outside the rings searched is further
+        if(best.size() == k && best.front().first <= reach * reach)
+            break;
+        if(visits == visited.size())
+            break;
+    }
+    std::sort_heap(best.begin(), best.end());
+    for(const auto &b: best)
+        res.push_back(b.second);
+}
+void SpatialGrid::pairs(std::vector<std::pair<uint32_t, uint32_t>> &res) const
+{
+    res.clear();
+    std::vector<uint32_t> found;
+    for(uint32_t i=0; i<items.size(); ++i)
+    {
+        glm::vec3 p(sorted.x[i], sorted.y[i], sorted.z[i]);
+        glm::ivec3 c = cell(p);
+        found.clear();
+        buckets(c - 1, c + 1, found);
+        for(uint32_t b: found)
+            for(uint32_t j=bucketStart[b]; j<bucketStart[b+1]; ++j)
+            {
+                if(items[j] <= items[i])  // each pair once
+                    continue;
+                float x = sorted.x[j] - p.x, y = sorted.y[j] - p.y, z = sorted.z[j] - p.z,
+                      r = sorted.r[i] + sorted.r[j];
+                if(x*x + y*y + z*z <= r*r)
+                    res.push_back(std::make_pair(items[i], items[j]));
+            }
+    }
+}
+}
@@ -0,0 +1,92 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include<vector>
+#include<utility>
+#include<cstdint>
+#include "bounds.h"
+#include "glm/glm.hpp"
+
+namespace agl {
+/*!
+ * \brief Uniform grid over spheres, stored in a hash table of cells.
+ *
+ * Each sphere goes into the cell of its center, and the cells are hashed into a table with at least twice as many
+ * buckets as spheres, so the memory only depends on the number of spheres and not on how far apart they are. #build
+ * sorts the spheres by bucket with a [counting sort](https://en.wikipedia.org/wiki/Counting_sort), in parallel over
+ * chunks of #AGL_GRID_CHUNK spheres, and copies them in that order, so the spheres of a bucket are contiguous in
+ * memory. Building again from scratch every frame is cheaper than keeping a tree up to date when everything moves.
+ *
+ * The queries visit the buckets of the cells around the query and test the distances exactly, so the hash collisions
+ * only cost time. The items are the indices of the spheres given to #build.
+ */
+class SpatialGrid
+{
+public:
+    float cellSize = 0;  //!< Size of the cells, see #build.
+    std::vector<uint32_t> bucketStart;  //!< First sorted item of each bucket, and the number of items at the end.
+    std::vector<uint32_t> items;  //!< The items, sorted by bucket.
+    BoundingSpheres sorted;  //!< The spheres of the #items, in the same order.
+
+    /*!
+     * \brief Rebuild the grid.
+     * \param spheres The spheres; the radii may be 0 for points.
+     * \param size Size of the cells, or 0 to pick it from the spheres. It is raised to at least twice the largest
+     * radius, so that overlapping spheres are always in neighbouring cells.
+     */
+    void build(const BoundingSpheres &spheres, float size=0);
+    /*!
+     * \brief Number of items.
+     */
+    inline size_t size() const
+    {
+        return items.size();
+    }
+    /*!
+     * \brief Find the items whose center is within a distance of a point.
+     * \param center The point.
+     * \param radius The distance.
+     * \param res Gets the items; it is not cleared.
+     */
+    void queryRadius(const glm::vec3 &center, float radius, std::vector<uint32_t> &res) const;
+    /*!
+     * \brief Find the items whose centers are nearest to a point.
+     * \param point The point.
+     * \param k Number of items to find.
+     * \param res Gets at most \a k items, nearest first; it is cleared.
+     *
+     * The rings of cells around the point are searched outwards until the \a k-th nearest so far is nearer than the
+     * next ring. The buckets already visited are marked in a table of the grid, so this must not run on several
+     * threads at once.
+     */
+    void nearest(const glm::vec3 &point, size_t k, std::vector<uint32_t> &res) const;
+    /*!
+     * \brief Find the pairs of overlapping spheres, the broad phase of a collision detection.
+     * \param res Gets the pairs, each once with the smaller item first; it is cleared.
+     */
+    void pairs(std::vector<std::pair<uint32_t, uint32_t>> &res) const;
+
+private:
+    glm::ivec3 cellMin,  //!< Smallest cell coordinates of a center.
+               cellMax;  //!< Largest cell coordinates of a center.
+    std::vector<uint32_t> bucketOf,  //!< Bucket of each sphere given to #build, kept to reuse the memory.
+                          counts;  //!< Count of each bucket for each chunk, kept to reuse the memory.
+    mutable std::vector<uint32_t> visited;  //!< Last search of #nearest that visited each bucket, sized by #build.
+    mutable uint32_t search = 0;  //!< Number of the current search of #nearest, so #visited needs no clearing.
+
+    /*!
+     * \brief Cell coordinates of a point.
+     */
+    glm::ivec3 cell(const glm::vec3 &p) const;
+    /*!
+     * \brief Bucket of a cell.
+     */
+    uint32_t bucket(const glm::ivec3 &c) const;
+    /*!
+     * \brief Add the distinct buckets of the cells from \a lo to \a hi to \a res, which it sorts.
+     */
+    void buckets(const glm::ivec3 &lo, const glm::ivec3 &hi, std::vector<uint32_t> &res) const;
+};
+}
+
+#endif // SPATIAL_GRID_H
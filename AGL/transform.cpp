@@ -0,0 +1,258 @@
+#include "transform.h"
+#include "glm/gtx/simd_mat4.hpp"
+#include<algorithm>
+
+namespace agl {
+namespace {
+// a * b; the columns of glm::mat4 are 4 packed floats
+inline void multiply(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &res)
+{
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+    __m128 a0 = _mm_loadu_ps(&a[0][0]), a1 = _mm_loadu_ps(&a[1][0]), a2 = _mm_loadu_ps(&a[2][0]),
+           a3 = _mm_loadu_ps(&a[3][0]);
+    for(int j=0; j<4; ++j)
+    {
+        __m128 r = _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[j].x)), _mm_mul_ps(a1, _mm_set1_ps(b[j].y)));
+        r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[j].z)), _mm_mul_ps(a3, _mm_set1_ps(b[j].w))));
+        _mm_storeu_ps(&res[j][0], r);
+    }
+#else
+    res = a * b;
+#endif
+}
+// translate(pos) * m, without the matrix product
+inline void addTranslation(glm::mat4 &m, const glm::vec3 &pos)
+{
+    for(int j=0; j<4; ++j)
+    {
+        m[j].x += pos.x * m[j].w;
+        m[j].y += pos.y * m[j].w;
+        m[j].z += pos.z * m[j].w;
+    }
+}
+// the normal matrix of a matrix with orthogonal columns, ie. R*S; (R*S)^-T = R*S^-1
+inline bool fastNormal(const glm::mat4 &m, glm::mat3 &n)
+{
+    const float *c0 = &m[0][0], *c1 = &m[1][0], *c2 = &m[2][0];  // plain floats, this runs for every moving entity
+    float l0 = c0[0]*c0[0] + c0[1]*c0[1] + c0[2]*c0[2],
+          l1 = c1[0]*c1[0] + c1[1]*c1[1] + c1[2]*c1[2],
+          l2 = c2[0]*c2[0] + c2[1]*c2[1] + c2[2]*c2[2],
+          d01 = c0[0]*c1[0] + c0[1]*c1[1] + c0[2]*c1[2],
+          d02 = c0[0]*c2[0] + c0[1]*c2[1] + c0[2]*c2[2],
+          d12 = c1[0]*c2[0] + c1[1]*c2[1] + c1[2]*c2[2], eps = 1e-10;  // relative, squared
+    if(d01*d01 > eps*l0*l1 || d02*d02 > eps*l0*l2 || d12*d12 > eps*l1*l2 || l0 == 0 || l1 == 0 || l2 == 0)
+        return false;
+    float *r = &n[0][0], s0 = 1 / l0, s1 = 1 / l1, s2 = 1 / l2;
+    for(int i=0; i<3; ++i)
+    {
+        r[i] = c0[i] * s0;
+        r[3+i] = c1[i] * s1;
+        r[6+i] = c2[i] * s2;
+    }
+    return true;
+}
+glm::mat3 fullNormal(const glm::mat4 &m)
+{
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+    glm::mat4 inv = glm::mat4_cast(glm::detail::inverse(glm::simdMat4(m)));
+#else
+    glm::mat4 inv = glm::inverse(m);
+#endif
+    return glm::mat3(glm::transpose(inv));
+}
+template<class T>
+void permute(std::vector<T> &v, const std::vector<uint32_t> &order)
+{
+    std::vector<T> res;
+    res.reserve(order.size());
+    for(uint32_t i: order)
+        res.push_back(v[i]);
+    v.swap(res);
+}
+}
+
+uint32_t TransformSystem::create()
+{
+    uint32_t id;
+    if(freeIDs.empty())
+    {
+        id = dense.size();
+        dense.push_back(0);
+    }
+    else
+    {
+        id = freeIDs.back();
+        freeIDs.pop_back();
+    }
+    dense[id] = ids.size();
+    position.push_back(glm::vec3(0));
+    local.push_back(glm::mat4());
+    world.push_back(glm::mat4());
+    normal.push_back(glm::mat3());
+    parent.push_back(-1);
+    flags.push_back(LOCAL_DIRTY);
+    ids.push_back(id);
+    return id;
+}
+void TransformSystem::destroy(uint32_t id)
+{
+    flags[dense[id]] = DEAD;
+    ++dead;
+    freeIDs.push_back(id);  // the dead slot is skipped by compact, so the ID can be reused right away
+}
+void TransformSystem::setParent(uint32_t id, int64_t parentID)
+{
+    uint32_t i = dense[id];
+    parent[i] = parentID < 0 ? -1 : dense[parentID];
+    flags[i] |= LOCAL_DIRTY;
+    if(parent[i] > int32_t(i))
+        reorder = true;
+}
+void TransformSystem::setPosition(uint32_t id, const glm::vec3 &pos)
+{
+    uint32_t i = dense[id];
+    position[i] = pos;
+    flags[i] |= LOCAL_DIRTY;
+}
+void TransformSystem::setLocal(uint32_t id, const glm::mat4 &m)
+{
+    uint32_t i = dense[id];
+    local[i] = m;
+    flags[i] |= LOCAL_DIRTY;
+}
+glm::mat4 TransformSystem::getWorld(uint32_t id) const
+{
+    int32_t i = dense[id], j = i;
+    while(j >= 0 && !(flags[j] & LOCAL_DIRTY))
+        j = parent[j];
+    if(j < 0)  // nothing changed since the last update
+        return world[i];
+    glm::mat4 m = local[i];
+    if(parent[i] >= 0)
+        m = getWorld(ids[parent[i]]) * m;
+    addTranslation(m, position[i]);
+    return m;
+}
+glm::mat3 TransformSystem::getNormal(uint32_t id) const
+{
+    int32_t i = dense[id], j = i;
+    while(j >= 0 && !(flags[j] & LOCAL_DIRTY))
+        j = parent[j];
+    if(j < 0 && (flags[i] & (NEEDS_NORMAL | NORMAL_STALE)) == NEEDS_NORMAL)
+        return normal[i];
+    glm::mat4 m = getWorld(id);
+    glm::mat3 n;
+    return fastNormal(m, n) ? n : fullNormal(m);
+}
+void TransformSystem::setNeedsNormal(uint32_t id, bool needs)
+{
+    uint8_t &f = flags[dense[id]];
+    f = needs ? f | NEEDS_NORMAL | NORMAL_STALE : f & ~NEEDS_NORMAL;
+}
+void TransformSystem::update()
+{
+    if(reorder || dead > 0)
+        compact();
+    pending.clear();
+    for(uint32_t i=0, n=ids.size(); i<n; ++i)
+    {
+        uint8_t f = flags[i] & ~WORLD_CHANGED;
+        int32_t p = parent[i];
+        if((f & LOCAL_DIRTY) || (p >= 0 && (flags[p] & WORLD_CHANGED)))  // the parent was swept already
+        {
+            glm::mat4 &w = world[i];
+            if(p >= 0)
+                multiply(world[p], local[i], w);
+            else
+                w = local[i];
+            addTranslation(w, position[i]);
+            f = (f & ~LOCAL_DIRTY) | WORLD_CHANGED | NORMAL_STALE;
+        }
+        if((f & (NEEDS_NORMAL | NORMAL_STALE)) == (NEEDS_NORMAL | NORMAL_STALE))
+        {
+            if(fastNormal(world[i], normal[i]))
+                f &= ~NORMAL_STALE;
+            else
+                pending.push_back(i);
+        }
+        flags[i] = f;
+    }
+    for(uint32_t i: pending)
+    {
+        normal[i] = fullNormal(world[i]);
+        flags[i] &= ~NORMAL_STALE;
+    }
+}
+uint32_t TransformSystem::size() const
+{
+    return ids.size() - dead;
+}
+void TransformSystem::compact()
+{
+    uint32_t n = ids.size();
+    std::vector<int32_t> depth(n, -1);
+    std::vector<uint32_t> path;
+    int32_t maxDepth = 0;
+    for(uint32_t i=0; i<n; ++i)
+    {
+        if(flags[i] & DEAD)
+            continue;
+        if(parent[i] >= 0 && (flags[parent[i]] & DEAD))  // orphans become roots
+        {
+            parent[i] = -1;
+            flags[i] |= LOCAL_DIRTY;
+        }
+    }
+    for(uint32_t i=0; i<n; ++i)
+    {
+        if(flags[i] & DEAD)
+            continue;
+        int32_t j = i;
+        path.clear();
+        while(j >= 0 && depth[j] < 0)
+        {
+            path.push_back(j);
+            j = parent[j];
+        }
+        int32_t d = j < 0 ? 0 : depth[j] + 1;
+        for(auto it=path.rbegin(); it!=path.rend(); ++it)
+            depth[*it] = d++;
+        maxDepth = std::max(maxDepth, d - 1);
+    }
+
+    // counting sort by depth, which keeps the parents before their children
+    std::vector<uint32_t> count(maxDepth + 2, 0), order(n - dead), newIndex(n);
+    for(uint32_t i=0; i<n; ++i)
+        if(!(flags[i] & DEAD))
+            ++count[depth[i] + 1];
+    for(int32_t d=0; d<=maxDepth; ++d)
+        count[d+1] += count[d];
+    for(uint32_t i=0; i<n; ++i)
+        if(!(flags[i] & DEAD))
+        {
+            newIndex[i] = count[depth[i]]++;
+            order[newIndex[i]] = i;
+        }
+    permute(position, order);
+    permute(local, order);
+    permute(world, order);
+    permute(normal, order);
+    permute(parent, order);
+    permute(flags, order);
+    permute(ids, order);
+    for(uint32_t i=0, l=ids.size(); i<l; ++i)
+    {
+        if(parent[i] >= 0)
+            parent[i] = newIndex[parent[i]];
+        dense[ids[i]] = i;
+    }
+    reorder = false;
+    dead = 0;
+}
+
+TransformSystem &getTransforms()
+{
+    static TransformSystem transforms;
+    return transforms;
+}
+}
@@ -0,0 +1,139 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include<vector>
+#include<cstdint>
+#include "glm/glm.hpp"
+
+namespace agl {
+/*!
+ * \brief Storage for the transforms of all the Entity, as a [structure of arrays](https://en.wikipedia.org/wiki/AoS_and_SoA).
+ *
+ * Each Entity owns a slot, identified by a stable ID (Entity#transformID). The slots are kept in dense arrays, sorted so
+ * that every parent comes before its children. #update can then refresh all the world matrices in a single linear
+ * sweep, reading only the arrays it needs. The dense index of a slot changes when the arrays are reordered, so always
+ * go through #index or the accessors taking an ID.
+ *
+ * For each slot the world matrix is <tt>translate(position) * (parentWorld * local)</tt>, ie. the #position is applied
+ * after the parent transformations, like Entity#getMatM always did.
+ *
+ * \sa getTransforms
+ */
+class TransformSystem
+{
+public:
+    /*!
+     * \brief Bits of #flags.
+     */
+    enum Flag: uint8_t
+    {
+        LOCAL_DIRTY = 1,  //!< The position, local matrix or parent changed since the last #update.
+        WORLD_CHANGED = 2,  //!< The world matrix changed in the last #update.
+        NORMAL_STALE = 4,  //!< The normal matrix is out of date.
+        NEEDS_NORMAL = 8,  //!< #update also refreshes the normal matrix.
+        DEAD = 16  //!< The slot was destroyed and is waiting to be compacted away.
+    };
+
+    std::vector<glm::vec3> position;  //!< Position of each slot, see Entity#setPosition.
+    std::vector<glm::mat4> local,  //!< Local matrix of each slot, see Entity#getModel.
+                           world;  //!< World matrix of each slot, valid after #update.
+    std::vector<glm::mat3> normal;  //!< Normal matrix of the slots with #NEEDS_NORMAL, valid after #update.
+    std::vector<int32_t> parent;  //!< Dense index of the parent of each slot, or -1. Always less than the slot's index.
+    std::vector<uint8_t> flags;  //!< Combination of Flag for each slot.
+    std::vector<uint32_t> ids;  //!< ID of each slot.
+
+    /*!
+     * \brief Create a slot with an identity transform at the origin.
+     * \return The ID of the slot.
+     */
+    uint32_t create();
+    /*!
+     * \brief Destroy a slot.
+     * \param id The ID of the slot.
+     *
+     * The children of the slot become roots. The slot is only removed from the arrays on the next #update.
+     */
+    void destroy(uint32_t id);
+    /*!
+     * \brief Get the dense index of a slot.
+     * \param id The ID of the slot.
+     */
+    inline uint32_t index(uint32_t id) const
+    {
+        return dense[id];
+    }
+    /*!
+     * \brief Set the parent of a slot.
+     * \param id The ID of the slot.
+     * \param parentID The ID of the parent, or -1 for none.
+     */
+    void setParent(uint32_t id, int64_t parentID);
+    /*!
+     * \brief Set the position of a slot.
+     */
+    void setPosition(uint32_t id, const glm::vec3 &pos);
+    /*!
+     * \brief Set the local matrix of a slot.
+     */
+    void setLocal(uint32_t id, const glm::mat4 &m);
+    /*!
+     * \brief Get the world matrix of a slot, even between the updates.
+     * \param id The ID of the slot.
+     * \return The world matrix.
+     *
+     * If neither the slot nor its parents changed since the last #update, this is the cached matrix. Otherwise the
+     * matrix is composed from the parents, without changing the cache.
+     */
+    glm::mat4 getWorld(uint32_t id) const;
+    /*!
+     * \brief Get the normal matrix of a slot, even between the updates.
+     * \param id The ID of the slot.
+     * \return The inverse transpose of the upper 3x3 of #getWorld.
+     */
+    glm::mat3 getNormal(uint32_t id) const;
+    /*!
+     * \brief Set if #update should keep the normal matrix of a slot.
+     * \param id The ID of the slot.
+     * \param needs Keep it?
+     */
+    void setNeedsNormal(uint32_t id, bool needs);
+    /*!
+     * \brief Refresh the world matrices that changed, and their normal matrices.
+     *
+     * The arrays are first compacted and sorted parent-before-child, if a slot was destroyed or reparented under a
+     * later slot. The sweep then goes once over the slots in order: a slot is recomputed if it is dirty or its parent's
+     * world changed in the same sweep. The normal matrices of the changed slots with #NEEDS_NORMAL are cheap if the
+     * world matrix has orthogonal columns, the rest are inverted together at the end, with the glm SIMD matrices when
+     * SSE2 is available.
+     */
+    void update();
+    /*!
+     * \brief Number of live slots.
+     */
+    uint32_t size() const;
+
+private:
+    std::vector<uint32_t> dense;  //!< ID -> dense index.
+    std::vector<uint32_t> freeIDs;  //!< IDs of the destroyed slots, for reuse.
+    std::vector<uint32_t> pending;  //!< Slots that need a full inverse in #update.
+    bool reorder = false;  //!< Must the arrays be sorted again before the next sweep?
+    uint32_t dead = 0;  //!< Number of destroyed slots still in the arrays.
+
+    /*!
+     * \brief Remove the dead slots and sort the arrays parent-before-child.
+     */
+    void compact();
+};
+/*!
+ * \brief Get the TransformSystem shared by all the Entity.
+ *
+ * There is a single system for the whole process, so every Entity has a slot in it, whether it is in a Scene or not.
+ * TransformSystem#update thus refreshes the entities of every Scene, and the ones in none: each Scene#render, and the
+ * first query of a Scene after entities changed, pays for all of them; with several scenes, or many entities that are
+ * never drawn, each one also updates the others'. The system is not synchronized, so the entities and the scenes must
+ * all be used from a single thread.
+ */
+TransformSystem &getTransforms();
+}
+
+#endif // TRANSFORM_H
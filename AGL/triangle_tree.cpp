@@ -0,0 +1,127 @@
+#include "triangle_tree.h"
+#include<algorithm>
+#include<cmath>
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+#include<xmmintrin.h>
+#endif
+
+namespace agl {
+void TriangleTree::update(const std::vector<GLfloat> &vertices, const std::vector<GLuint> &indices)
+{
+    size_t n = indices.size() / 3;
+    std::vector<glm::vec3> mins(n), maxs(n);
+    auto vertex = [&](GLuint i) {
+        return glm::vec3(vertices[3*i], vertices[3*i + 1], vertices[3*i + 2]);
+    };
+    for(size_t i=0; i<n; ++i)
+    {
+        glm::vec3 a = vertex(indices[3*i]), b = vertex(indices[3*i + 1]), c = vertex(indices[3*i + 2]);
+        mins[i] = glm::min(glm::min(a, b), c);
+        maxs[i] = glm::max(glm::max(a, b), c);
+    }
+    if(!tree.refit(mins, maxs))
+        tree.build(mins, maxs);
+    for(int k=0; k<3; ++k)  // padded, so that the last leaf can be loaded four triangles at a time
+    {
+        v0[k].assign(n + 3, 0);
+        e1[k].assign(n + 3, 0);
+        e2[k].assign(n + 3, 0);
+    }
+    for(size_t i=0; i<n; ++i)
+    {
+        uint32_t tri = tree.order[i];
+        glm::vec3 a = vertex(indices[3*tri]), b = vertex(indices[3*tri + 1]), c = vertex(indices[3*tri + 2]);
+        for(int k=0; k<3; ++k)
+        {
+            v0[k][i] = a[k];
+            e1[k][i] = b[k] - a[k];
+            e2[k][i] = c[k] - a[k];
+        }
+    }
+}
+bool TriangleTree::raycast(const glm::vec3 &origin, const glm::vec3 &dir, float &t, uint32_t &triangle,
+                           glm::vec2 &barycentric) const
+{
+    return tree.raycastLeaves(origin, dir, t, [&](uint32_t first, uint32_t count, float &best) {
+        bool hit = false;
+        uint32_t i = first, end = first + count;
+#if(GLM_ARCH & GLM_ARCH_SSE2)
+        __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z),
+               dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z),
+               zero = _mm_setzero_ps(), one = _mm_set1_ps(1), lanes = _mm_set_ps(3, 2, 1, 0);
+        for(; i<end; i+=4)
+        {
+            __m128 e1x = _mm_loadu_ps(&e1[0][i]), e1y = _mm_loadu_ps(&e1[1][i]), e1z = _mm_loadu_ps(&e1[2][i]),
+                   e2x = _mm_loadu_ps(&e2[0][i]), e2y = _mm_loadu_ps(&e2[1][i]), e2z = _mm_loadu_ps(&e2[2][i]);
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y)),  // dir x e2
+                   py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z)),
+                   pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz)),
+                   inv = _mm_div_ps(one, det);
+            __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(&v0[0][i])), ty = _mm_sub_ps(oy, _mm_loadu_ps(&v0[1][i])),
+                   tz = _mm_sub_ps(oz, _mm_loadu_ps(&v0[2][i]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)),
+                                  inv);
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y)),  // (origin - v0) x e1
+                   qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z)),
+                   qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+                                  inv),
+                   d = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+                                  inv);
+            // a degenerate triangle divides by 0, and the NaNs fail all the compares
+            __m128 in = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+                                   _mm_and_ps(_mm_cmple_ps(_mm_add_ps(u, v), one), _mm_cmpge_ps(d, zero)));
+            in = _mm_and_ps(in, _mm_and_ps(_mm_cmplt_ps(d, _mm_set1_ps(best)),
+                                           _mm_cmplt_ps(lanes, _mm_set1_ps(float(end - i)))));
+            int mask = _mm_movemask_ps(in);
+            if(mask == 0)
+                continue;
+            float us[4], vs[4], ds[4];
+            _mm_storeu_ps(us, u);
+            _mm_storeu_ps(vs, v);
+            _mm_storeu_ps(ds, d);
+            for(int k=0; k<4; ++k)
+                if((mask >> k) & 1 && ds[k] < best)
+                {
+                    best = ds[k];
+                    triangle = tree.order[i + k];
+                    barycentric = glm::vec2(us[k], vs[k]);
+                    hit = true;
+                }
+        }
+#endif
+        for(; i<end; ++i)
+        {
+            glm::vec3 a(v0[0][i], v0[1][i], v0[2][i]), ab(e1[0][i], e1[1][i], e1[2][i]),
+                      ac(e2[0][i], e2[1][i], e2[2][i]);
+            glm::vec3 p = glm::cross(dir, ac);
+            float det = glm::dot(ab, p);
+            if(det == 0)
+                continue;
+            float inv = 1 / det;
+            glm::vec3 s = origin - a;
+            float u = glm::dot(s, p) * inv;
+            glm::vec3 q = glm::cross(s, ab);
+            float v = glm::dot(dir, q) * inv, d = glm::dot(ac, q) * inv;
+            if(u >= 0 && v >= 0 && u + v <= 1 && d >= 0 && d < best)
+            {
+                best = d;
+                triangle = tree.order[i];
+                barycentric = glm::vec2(u, v);
+                hit = true;
+            }
+        }
+        return hit;
+    });
+}
+size_t TriangleTree::memoryUsage() const
+{
+    size_t res = sizeof(TriangleTree) + tree.nodes.capacity() * sizeof(BVH::Node) +
+                 tree.order.capacity() * sizeof(uint32_t) +
+                 (tree.itemMin.capacity() + tree.itemMax.capacity()) * sizeof(glm::vec3);
+    for(int k=0; k<3; ++k)
+        res += (v0[k].capacity() + e1[k].capacity() + e2[k].capacity()) * sizeof(float);
+    return res;
+}
+}
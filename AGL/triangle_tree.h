@@ -0,0 +1,52 @@
+#ifndef TRIANGLE_TREE_H
+#define TRIANGLE_TREE_H
+
+#include<vector>
+#include<cstdint>
+#include<GL/gl.h>
+#include "bvh.h"
+#include "glm/glm.hpp"
+
+namespace agl {
+/*!
+ * \brief A BVH over the triangles of a Mesh, for ray picking.
+ *
+ * The items of the #tree are the triangles, numbered like the triplets of Mesh#indices. Next to the tree, the first
+ * vertex and the two edges from it of each triangle are copied in the order of the leaves, as a structure of arrays.
+ * The triangles of a leaf are thus contiguous, and with SSE a leaf of up to four triangles is tested against the ray in
+ * one go, with the [Möller–Trumbore](https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm)
+ * algorithm. The copies make the tree independent of the Mesh, which may release its geometry afterwards.
+ */
+class TriangleTree
+{
+public:
+    BVH tree;  //!< The hierarchy over the boxes of the triangles.
+    std::vector<float> v0[3],  //!< X, Y and Z of the first vertex of each triangle, in the order of the leaves.
+                       e1[3],  //!< Edge from the first to the second vertex.
+                       e2[3];  //!< Edge from the first to the third vertex.
+
+    /*!
+     * \brief Build the tree, or refit it if the number of triangles did not change.
+     * \param vertices Vertices of the mesh, 3 floats each.
+     * \param indices Indices of the mesh, 3 per triangle.
+     */
+    void update(const std::vector<GLfloat> &vertices, const std::vector<GLuint> &indices);
+    /*!
+     * \brief Find the nearest triangle hit by a ray, from both sides.
+     * \param origin Origin of the ray.
+     * \param dir Direction of the ray; the distances are in its lengths.
+     * \param t Maximum distance along the ray; gets the distance of the hit.
+     * \param triangle Gets the triangle hit.
+     * \param barycentric Gets the weights of the second and third vertices of the triangle at the hit.
+     * \return Was anything hit?
+     */
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &dir, float &t, uint32_t &triangle,
+                 glm::vec2 &barycentric) const;
+    /*!
+     * \brief Bytes of memory used.
+     */
+    size_t memoryUsage() const;
+};
+}
+
+#endif // TRIANGLE_TREE_H
@@ -2,57 +2,93 @@
 #include<sstream>
 #include<fstream>
 
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 namespace agl {
-GLuint loadShaders(std::string vertShader, std::string fragShader)
+namespace {
+bool parallelCompile = false;  // GL_KHR_parallel_shader_compile is available
+}
+
+GLuint loadShaders(std::string vertShader, std::string fragShader, bool retrievable)
+{
+    GLuint progID = submitShaders(vertShader, fragShader, retrievable);
+    if(finishShaders(progID) == 0)
+    {
+        glDeleteProgram(progID);
+        return 0;
+    }
+    return progID;
+}
+GLuint submitShaders(const std::string &vertShader, const std::string &fragShader, bool retrievable)
 {
     GLuint vsID = glCreateShader(GL_VERTEX_SHADER),
-           fsID = glCreateShader(GL_FRAGMENT_SHADER);
-    GLint res = 1, logLen;
+           fsID = glCreateShader(GL_FRAGMENT_SHADER),
+           progID = glCreateProgram();
 
     const char *code = vertShader.c_str();
     glShaderSource(vsID, 1, &code, nullptr);
     glCompileShader(vsID);
-    glGetShaderiv(vsID, GL_COMPILE_STATUS, &res);
-    glGetShaderiv(vsID, GL_INFO_LOG_LENGTH, &logLen);
-    if(!res)
-    {
-        char errMsg[logLen];
-        glGetShaderInfoLog(vsID, logLen, nullptr, errMsg);
-        fprintf(stderr, "Error in loading vertex shader.\n%s\n", errMsg);
-        return 0;
-    }
-
     code = fragShader.c_str();
     glShaderSource(fsID, 1, &code, nullptr);
     glCompileShader(fsID);
-    glGetShaderiv(fsID, GL_COMPILE_STATUS, &res);
-    glGetShaderiv(fsID, GL_INFO_LOG_LENGTH, &logLen);
-    if(!res)
-    {
-        char errMsg[logLen];
-        glGetShaderInfoLog(fsID, logLen, nullptr, errMsg);
-        fprintf(stderr, "Error in loading fragment shader.\n%s\n", errMsg);
-        return 0;
-    }
 
-    GLuint progID = glCreateProgram();
     glAttachShader(progID, vsID);
     glAttachShader(progID, fsID);
+    if(retrievable)
+        glProgramParameteri(progID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(progID);
-    glGetProgramiv(progID, GL_LINK_STATUS, &res);
-    glGetProgramiv(progID, GL_INFO_LOG_LENGTH, &logLen);
-    if(!res)
+    return progID;
+}
+bool isProgramReady(GLuint progID)
+{
+    if(!parallelCompile)
+        return true;
+    GLint res = GL_TRUE;
+    glGetProgramiv(progID, GL_COMPLETION_STATUS_KHR, &res);
+    return res == GL_TRUE;
+}
+GLuint finishShaders(GLuint progID)
+{
+    GLuint shaders[2];
+    GLsizei count = 0;
+    GLint res = 1, logLen;
+    bool compiled = true;  // all of them; a failure is reported on its own, the link log would only repeat it
+    glGetAttachedShaders(progID, 2, &count, shaders);
+    for(int i=0; i<count; ++i)
     {
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &res);
+        compiled = compiled && res;
+        if(!res)
+        {
+            GLint type;
+            glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+            glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &logLen);
+            char errMsg[logLen];
+            glGetShaderInfoLog(shaders[i], logLen, nullptr, errMsg);
+            fprintf(stderr, "Error in loading %s shader.\n%s\n", type==GL_VERTEX_SHADER ? "vertex" : "fragment", errMsg);
+        }
+    }
+    GLint linked = 0;
+    glGetProgramiv(progID, GL_LINK_STATUS, &linked);
+    if(!linked && compiled)
+    {
+        glGetProgramiv(progID, GL_INFO_LOG_LENGTH, &logLen);
         char errMsg[logLen];
         glGetProgramInfoLog(progID, logLen, nullptr, errMsg);
         fprintf(stderr, "Error in loading program.\n%s\n", errMsg);
-        return 0;
     }
-    glDetachShader(progID, vsID);
-    glDetachShader(progID, fsID);
-    glDeleteShader(vsID);
-    glDeleteShader(fsID);
-    return progID;
+    for(int i=0; i<count; ++i)
+    {
+        glDetachShader(progID, shaders[i]);
+        glDeleteShader(shaders[i]);
+    }
+    return linked ? progID : 0;
+}
+void setParallelShaderCompile(bool available)
+{
+    parallelCompile = available;
 }
 GLuint loadShadersFromFile(const char* vsPath, const char* fsPath)
 {
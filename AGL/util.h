@@ -9,12 +9,47 @@ namespace agl {
  * \brief Load a pair of shaders.
  * \param vertShader The vertex shader.
  * \param fragShader The fragment shader.
+ * \param retrievable If \c true, hints the driver that the binary will be read back with \c glGetProgramBinary.
  * \return The program ID after loading the shaders.
  *
  * This function takes in two strings consisting a vertex and a fragment shader, compiles them and creates a program. It
  * loads the program in the current OpenGL context and returns the program ID which can be used to access the shaders.
  */
-GLuint loadShaders(std::string vertShader, std::string fragShader);
+GLuint loadShaders(std::string vertShader, std::string fragShader, bool retrievable=false);
+/*!
+ * \brief Start loading a pair of shaders without waiting for the driver.
+ * \param vertShader The vertex shader.
+ * \param fragShader The fragment shader.
+ * \param retrievable See #loadShaders.
+ * \return The program ID.
+ *
+ * This submits the compilation of both the shaders and the linking of the program, but does not query any status, so
+ * the driver can work on many programs at once (in parallel with \c GL_KHR_parallel_shader_compile). Use
+ * #isProgramReady to poll the program and #finishShaders to check the result before using it.
+ */
+GLuint submitShaders(const std::string &vertShader, const std::string &fragShader, bool retrievable=false);
+/*!
+ * \brief Check if a program from #submitShaders has finished compiling and linking.
+ * \param progID The program ID.
+ * \return \c true if #finishShaders will not block. Always \c true without \c GL_KHR_parallel_shader_compile.
+ */
+bool isProgramReady(GLuint progID);
+/*!
+ * \brief Finish loading a program from #submitShaders.
+ * \param progID The program ID.
+ * \return \a progID if the program linked, 0 otherwise.
+ *
+ * This waits for the program, prints the errors, if any, and releases the shader objects. The program is not deleted
+ * on failure.
+ */
+GLuint finishShaders(GLuint progID);
+/*!
+ * \brief Tell AGL if \c GL_KHR_parallel_shader_compile is available.
+ * \param available Is the extension available?
+ *
+ * Scene sets this when it creates the context. It enables the non-blocking status queries in #isProgramReady.
+ */
+void setParallelShaderCompile(bool available);
 /*!
  * \brief Load shaders from files.
  * \param vsPath Path to the vertex shader.
@@ -53,6 +88,16 @@ void saveImage(const char* path, int w, int h);
 #define AGL_GLVERSION_MAJOR 3  //!< OpenGL major version.
 #define AGL_GLVERSION_MINOR 3  //!< OpenGL minor version.
 
+#define AGL_LIGHTS_BINDING 0  //!< Uniform buffer binding point of the \c Lights block in the generated shaders.
+#define AGL_FRAME_BINDING 1  //!< Uniform buffer binding point of the per-frame \c Frame block.
+#define AGL_INSTANCE_ATTRIB 3  //!< First vertex attribute used by the per-instance data (\c M, \c N and the emission).
+#define AGL_INSTANCE_MIN 2  //!< Minimum number of entities sharing a mesh and a material to be drawn instanced.
+#define AGL_BVH_BINS 12  //!< Number of bins evaluated by the SAH build of a BVH.
+#define AGL_BVH_LEAF_SIZE 4  //!< A BVH node with at most this many items is a leaf.
+#define AGL_BVH_REFIT_LIMIT 2  //!< Growth of the total area of a refitted BVH after which it is built again.
+#define AGL_GRID_CHUNK 4096  //!< Spheres per thread when a SpatialGrid is built in parallel.
+#define AGL_RING_FRAMES 3  //!< Frames in flight, ie. regions of a RingBuffer written while the GPU reads the others.
+
 #define AGL_GLFW_INIT_ERROR 1  //!< Error if GLFW was not initialised.
 #define AGL_GLFW_CREATE_WINDOW_ERROR 2  //!< Error if window was not created.
 /*! @}*/
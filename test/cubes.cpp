@@ -20,18 +20,15 @@ int main_cubes()
     scene.add(light);  // add the light to the scene
 
     int n = 5;  // number of cubes
-    std::vector<agl::Entity> cubes {};  // needed to store the cubes
     for(int i=0; i<n; ++i)
         for(int j=0; j<n; ++j)
         {
             agl::Entity cube = agl::cube(true);  // create a cube with normals
-            cube.position = glm::vec3(2*i-n+1, 0, 2*j-n+1);  // set the position
-            cube.material = materials[std::rand()%materials.size()];  // set the material; this is inefficient since
-                                                                      // every cube gets a new shader
-            cubes.push_back(cube);  // store the cube
+            cube.setPosition(2*i-n+1, 0, 2*j-n+1);  // set the position
+            cube.material = materials[std::rand()%materials.size()];  // set the material; all the cubes generate the
+                                                                      // same shader, so they share one program
+            scene.spawn(cube);  // add a copy owned by the scene
         }
-    for(agl::Entity &cube: cubes)
-        scene.add(cube);  // add all the cubes to the scene
 
     scene.enableLights();  // enable lighting shaders
     scene.prepare();  // prepare the scene (build the shaders, VBOs etc.)
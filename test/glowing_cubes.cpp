@@ -14,7 +14,7 @@ int main_glowing_cubes()
     light.quadraticAttenuation = 0.075;
     agl::Entity lightCube = agl::cube();  // create a visual for the light
     lightCube.add(light);
-    lightCube.position = glm::vec3(-2, -2, 2);  // set cube parameters
+    lightCube.setPosition(-2, -2, 2);  // set cube parameters
     lightCube.scale(.15);
     lightCube.material.emission = light.diffuse;
     scene.add(lightCube);  // add the cube, and the light hence, to the scene
@@ -29,8 +29,9 @@ int main_glowing_cubes()
     {
         cubes.push_back(agl::cube(true, true));  // create all the cubes
         cubes[i].material.customShader = true;
-        cubes[i].position = glm::ballRand(10.f);  // set them at a random position
-        cubes[i].position.y *= .67;
+        glm::vec3 pos = glm::ballRand(10.f);  // set them at a random position
+        pos.y *= .67;
+        cubes[i].setPosition(pos);
         axes.push_back(glm::ballRand(1.f));  // add a random axis of rotation
         rads.push_back(glm::circularRand(1.f));  // add a random speed for rotation
     }
@@ -39,6 +40,7 @@ int main_glowing_cubes()
         scene.add(cube);  // add all the cubes
     scene.enableLights();  // enable lighting calculations
     lightCube.material.lightsEnabled = false;  // don't want the light cube lighted up
+    scene.useGrid = true;  // everything moves every frame, a grid is cheaper to keep than a tree
     scene.prepare();  // prepare the scene
 
     auto shader = cubes[0].material.createShader(&cubes[0], scene.lights);  // create the default shader for the first cube
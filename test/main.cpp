@@ -34,7 +34,7 @@ int main_()
 
     cube.material.createTexture("../texture/rough_wood_1.jpg");
     cube.material.customShader = true;
-    plane.position.y = -1;
+    plane.setPosition(0, -1, 0);
     plane.material.createTexture("../texture/leaves_1.jpg");
 
 //    scene.add(plane);
@@ -47,7 +47,7 @@ int main_()
     shader.second = agl::readTextFile("../shaders/glow.fsh");
     cube.material.setShader(shader.first, shader.second);
     int i = 0;
-    glEnable(GL_CULL_FACE);
+    agl::setCapability(GL_CULL_FACE, true);
     while(glfwWindowShouldClose(scene.window) == 0)
     {
         cube.rotate(0.01, glm::vec3(0, 1, 0));
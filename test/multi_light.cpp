@@ -8,7 +8,7 @@ int main_multi_light()
             plane = agl::plane(100, 100, true),
             light1_holder = agl::cube(), light2_holder = agl::cube(), light3_holder = agl::cube();
     plane.material = agl::Material::white_plastic + agl::Material::white_rubber;
-    plane.position.y = -1.5;
+    plane.setPosition(0, -1.5, 0);
 
     agl::Light light1(glm::vec3(0), 0, 0, 1),
                light2(glm::vec3(0), 0, 1, 0),
@@ -27,9 +27,9 @@ int main_multi_light()
     light1_holder.material.ambient = light1.diffuse;
     light2_holder.material.ambient = light2.diffuse;
     light3_holder.material.ambient = light3.diffuse;
-    light1_holder.position = glm::vec3(1, .75, 4);
-    light2_holder.position = glm::vec3(1, 3, -1);
-    light3_holder.position = glm::vec3(-3, -1, 2);
+    light1_holder.setPosition(1, .75, 4);
+    light2_holder.setPosition(1, 3, -1);
+    light3_holder.setPosition(-3, -1, 2);
 
     cube1.material = agl::Material::brass;
     cube2.material = agl::Material::bronze;